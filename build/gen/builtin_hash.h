@@ -0,0 +1,77 @@
+/* Generated by util/gen_builtin_hash.  Do not edit. */
+#ifndef _BUILTIN_HASH_H
+#define _BUILTIN_HASH_H
+
+#define BUILTIN_HASH_COUNT 27
+#define BUILTIN_HASH_SEED 0x000000e2u
+#define BUILTIN_HASH_SIZE 64
+
+/* The builtin_commands[] index for each slot, or -1. */
+static const short builtin_hash_slots[BUILTIN_HASH_SIZE] = {
+	[0] = 14, /* kill */
+	[1] = -1,
+	[2] = -1,
+	[3] = 15, /* memo */
+	[4] = -1,
+	[5] = 13, /* jobs */
+	[6] = 9, /* exit */
+	[7] = -1,
+	[8] = -1,
+	[9] = 23, /* trace */
+	[10] = -1,
+	[11] = 5, /* echo */
+	[12] = -1,
+	[13] = -1,
+	[14] = 21, /* source */
+	[15] = 7, /* env */
+	[16] = -1,
+	[17] = 0, /* . */
+	[18] = -1,
+	[19] = 10, /* export */
+	[20] = 8, /* exec */
+	[21] = -1,
+	[22] = 22, /* test */
+	[23] = 25, /* unset */
+	[24] = -1,
+	[25] = 6, /* enable */
+	[26] = -1,
+	[27] = -1,
+	[28] = -1,
+	[29] = -1,
+	[30] = 3, /* cd */
+	[31] = -1,
+	[32] = -1,
+	[33] = 11, /* help */
+	[34] = 2, /* bench */
+	[35] = 17, /* printf */
+	[36] = -1,
+	[37] = 12, /* history */
+	[38] = -1,
+	[39] = -1,
+	[40] = 26, /* which */
+	[41] = 24, /* type */
+	[42] = 18, /* read */
+	[43] = 1, /* [ */
+	[44] = -1,
+	[45] = -1,
+	[46] = 19, /* set */
+	[47] = -1,
+	[48] = 4, /* command */
+	[49] = -1,
+	[50] = -1,
+	[51] = -1,
+	[52] = 16, /* parallel */
+	[53] = -1,
+	[54] = -1,
+	[55] = -1,
+	[56] = 20, /* shellstats */
+	[57] = -1,
+	[58] = -1,
+	[59] = -1,
+	[60] = -1,
+	[61] = -1,
+	[62] = -1,
+	[63] = -1,
+};
+
+#endif /* _BUILTIN_HASH_H */
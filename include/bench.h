@@ -0,0 +1,39 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct bench_options {
+	/* Timed runs of each command line. */
+	unsigned int runs;
+	/* Untimed runs of each command line first. */
+	unsigned int warmup;
+	/* Let the command lines' standard output through. */
+	bool show_output;
+};
+
+/**
+ * bench_run() - time command lines, and report statistics
+ *
+ * Each command line is run through the dispatcher, in this shell,
+ * so nothing but the command itself is timed.  For each, the mean,
+ * standard deviation, range and percentiles of the wall clock time
+ * are printed to the builtin output, with the mean user and system
+ * time and any outliers.  Given more than one command line, they are
+ * compared against the fastest.
+ *
+ * While they run, the command lines read from /dev/null, and their
+ * standard output is discarded unless @opts->show_output is set.
+ * This must be called from the shell's main thread.
+ *
+ * @cmds:       The command lines.
+ * @n_cmds:     The number of command lines.
+ * @opts:       The options.
+ *
+ * Return: zero on success, or 1 if any run failed.
+ */
+int bench_run(const char *const cmds[], size_t n_cmds,
+	      const struct bench_options *opts);
+
+#endif /* _BENCH_H */
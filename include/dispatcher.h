@@ -2,6 +2,7 @@
 #define _DISPATCHER_H
 
 #include <stdbool.h>
+#include <sys/types.h>
 
 /**
  * shell_command_dispatcher() - run a shell command
@@ -17,4 +18,55 @@
 int shell_command_dispatcher(const char *input, int last_rv,
 			     bool *shell_should_exit);
 
+/**
+ * exec_path() - execute a program, replacing the current process
+ *
+ * Files without a "#!" line are run with /bin/sh, as execvp() does.
+ *
+ * @path:   The path of the program.
+ * @argv:   The arguments, NULL terminated.
+ * @envp:   The environment, NULL terminated.
+ *
+ * This only returns on failure, with errno set.
+ */
+void exec_path(const char *path, const char *const argv[],
+	       char *const envp[]);
+
+/**
+ * spawn_command() - start a command in a child process
+ *
+ * This is how pipeline stages are started, for builtins which run
+ * other commands themselves.  A builtin is run in the child, and an
+ * external command is found through the path cache and exec'd.
+ *
+ * @argv:       The command and its arguments, NULL terminated.
+ * @envp:       The environment for the command.
+ * @in_fd:      The fd to move onto the command's stdin.
+ * @out_fd:     The fd to move onto its stdout.
+ * @err_fd:     The fd to move onto its stderr.
+ *
+ * Return: the pid of the child, or -1 if it could not be forked.
+ */
+pid_t spawn_command(const char *const argv[], char *const envp[], int in_fd,
+		    int out_fd, int err_fd);
+
+/**
+ * spawn_external() - start an external command in a child process
+ *
+ * This is spawn_command() for builtins such as "env", which run the
+ * program even when there is a builtin of the same name.
+ *
+ * Return: the pid of the child, or -1 if it could not be forked.
+ */
+pid_t spawn_external(const char *const argv[], char *const envp[], int in_fd,
+		     int out_fd, int err_fd);
+
+/**
+ * wait_command() - wait for a command started by spawn_command() or
+ * spawn_external()
+ *
+ * Return: its exit status, or -1 if it was killed by a signal.
+ */
+int wait_command(pid_t pid);
+
 #endif /* _DISPATCHER_H */
@@ -0,0 +1,38 @@
+#ifndef _HISTINDEX_H
+#define _HISTINDEX_H
+
+/*
+ * A prefix index over the history, used for autosuggestions.  It is a
+ * radix tree where every node remembers the most recently added line
+ * below it, so finding the most recent line starting with a prefix
+ * takes time proportional to the length of the prefix, regardless of
+ * the size of the history.
+ */
+
+/**
+ * hist_index_add() - add a line to the index
+ *
+ * The line becomes the most recent match for each of its prefixes.
+ * Adding a line which is already present only updates its recency.
+ *
+ * @line:   The line.  A copy is kept by the index.
+ */
+void hist_index_add(const char *line);
+
+/**
+ * hist_index_lookup() - find the most recent line with a prefix
+ *
+ * @prefix:   The prefix to search for.
+ *
+ * Return: the most recently added line starting with @prefix, or NULL
+ * if there is none.  The string is owned by the index, and is valid
+ * until hist_index_clear() is called.
+ */
+const char *hist_index_lookup(const char *prefix);
+
+/**
+ * hist_index_clear() - remove every line from the index
+ */
+void hist_index_clear(void);
+
+#endif /* _HISTINDEX_H */
@@ -19,7 +19,36 @@
 char *default_prompt_generator(int last_return_code);
 
 /**
- * interact() - run a prompt loop with readline and history enabled
+ * interact_set_line_editor() - choose the line editor used by interact()
+ *
+ * @name:   "readline" for GNU readline (the default), or "builtin"
+ *          for the in-tree editor in lineedit.h.  Shells built with
+ *          LINE_EDITOR=builtin only support the latter.
+ *
+ * Return: zero on success, or -1 if @name is not a supported editor.
+ */
+int interact_set_line_editor(const char *name);
+
+/**
+ * interact_record() - record the session to a file
+ *
+ * Once enabled, every line run by interact() is appended to the
+ * recording along with its start time, duration, working directory
+ * and return value.  The "replay" program can re-run a recording.
+ *
+ * @path:   The recording to append to.
+ *
+ * Return: zero on success, or -1 if the file could not be opened.
+ */
+int interact_record(const char *path);
+
+/**
+ * interact() - run a prompt loop with line editing and history enabled
+ *
+ * Bracketed paste is enabled, so a multi-line paste is returned as a
+ * single input.  It is added to the history as one entry, and its
+ * lines are passed to the dispatcher one at a time without
+ * generating a prompt in between.
  *
  * @prompt_generator:    A callback function to generate prompt strings.
  *                       This function should create newly-allocated
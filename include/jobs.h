@@ -0,0 +1,70 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * The job table: pipelines run in the background with "&".
+ *
+ * A pidfd is opened for every process of a job as soon as it starts.
+ * Until the shell reaps a process its pid cannot be reused, and after
+ * that the pidfd still refers to the process which exited, so a job is
+ * never confused with an unrelated process which happens to get the
+ * same pid.  The table is shared by every thread, behind a lock.
+ */
+
+/**
+ * jobs_add() - record a pipeline which was started in the background
+ *
+ * @pids:       The pids of the pipeline's processes, in order.
+ * @n_pids:     The number of processes.
+ * @cmdline:    The command line, as shown by "jobs".
+ *
+ * Return: the job number.
+ */
+int jobs_add(const pid_t pids[], size_t n_pids, const char *cmdline);
+
+/**
+ * jobs_update() - reap the processes of jobs which have exited
+ *
+ * This does not block.  Finished jobs stay in the table until they
+ * have been reported, by "jobs" or by this.
+ *
+ * @notify:     Report finished jobs on stderr, and forget them.
+ */
+void jobs_update(bool notify);
+
+/**
+ * jobs_print() - list the jobs to the builtin output
+ *
+ * Finished jobs are forgotten once they have been listed.
+ *
+ * @show_pids:  Also list the pid of each process of the job.
+ */
+void jobs_print(bool show_pids);
+
+/**
+ * jobs_signal() - send a signal to a job or a process
+ *
+ * A job spec is "%N" for job N, "%%" or "%+" for the most recent job,
+ * "%-" for the one before, or "%NAME" for the most recent job whose
+ * command line starts with NAME.  Every process of a job is signalled.
+ *
+ * A pid of a process in a job is signalled through its pidfd, and with
+ * @group, so is every other process in the job.  Any other pid is
+ * signalled through a pidfd opened on the spot, which is no safer than
+ * kill(2) since the process is not the shell's child.
+ *
+ * Errors are printed to stderr, prefixed with "kill".
+ *
+ * @target:     The job spec or pid.
+ * @sig:        The signal, or zero to only check the target exists.
+ * @group:      Signal the whole job of a pid.
+ *
+ * Return: zero on success, or -1 on failure.
+ */
+int jobs_signal(const char *target, int sig, bool group);
+
+#endif /* _JOBS_H */
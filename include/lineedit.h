@@ -0,0 +1,60 @@
+#ifndef _LINEEDIT_H
+#define _LINEEDIT_H
+
+/**
+ * A completion function.  Given the word under the cursor, as @text,
+ * and its byte offsets @start and @end in the line, return a
+ * newly-allocated, NULL-terminated array of newly-allocated
+ * candidate replacements for the word, or NULL if there are none.
+ *
+ * This has the same shape as readline's rl_completion_func_t, so a
+ * single completer can serve both line editors.
+ */
+typedef char **lineedit_completion_func_t(const char *text, int start,
+					  int end);
+
+/**
+ * The completion function called when TAB is pressed.  By default,
+ * this completes filenames.
+ */
+extern lineedit_completion_func_t *lineedit_completion_hook;
+
+/**
+ * The hint function, or NULL for none.  It is called with the line
+ * whenever the cursor is at its end, and may return text which is
+ * displayed dimmed after the cursor.  Pressing the right arrow
+ * inserts it.  The returned string is not freed.
+ */
+extern const char *(*lineedit_hint_hook)(const char *line);
+
+/**
+ * lineedit() - read a line from the terminal, with editing
+ *
+ * A minimal replacement for readline().  When standard input is a
+ * terminal, it is put in raw mode and the following keys are
+ * supported:
+ *
+ *    Left, Right, ^B, ^F      Move by one character (Right at the
+ *                             end of the line accepts any hint)
+ *    Home, End, ^A, ^E        Move to the start or end of the line
+ *    Backspace, Delete, ^D    Delete a character (^D on an empty
+ *                             line is end-of-file)
+ *    ^K, ^U, ^W               Kill to the end, to the start, or the
+ *                             previous word
+ *    Up, Down, ^P, ^N         Browse the history
+ *    TAB                      Complete using lineedit_completion_hook
+ *    ^L                       Clear the screen
+ *    ^C                       Discard the line
+ *
+ * Cursor movement and display account for multi-byte UTF-8 and
+ * double-width characters.  Bracketed pastes are inserted as-is,
+ * including any newlines.
+ *
+ * @prompt:  The prompt to display.
+ *
+ * Return: a newly allocated buffer with the line, without a trailing
+ * newline, or NULL at end-of-file.
+ */
+char *lineedit(const char *prompt);
+
+#endif /* _LINEEDIT_H */
@@ -0,0 +1,81 @@
+#ifndef _MEMO_H
+#define _MEMO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A store of command results, for "memo".
+ *
+ * Each result is keyed by a hash of the command line, the current
+ * directory, the program's path, size, mtime and inode, and whatever
+ * inputs the caller declares: the standard input, environment
+ * variables, and the contents or metadata of files.  An entry holds
+ * the command's standard output, standard error and exit status, in
+ * a file named after the key, so a repeated command with unchanged
+ * inputs is replayed rather than run.
+ *
+ * The store is $MEMO_DIR, or "shell-memo" in $XDG_CACHE_HOME or
+ * ~/.cache.  When it grows beyond $MEMO_MAX_SIZE bytes (default
+ * 64M, and a K, M or G suffix is allowed), the least recently used
+ * entries are removed.
+ */
+
+/* The inputs which go into a command's key, besides the command. */
+struct memo_inputs {
+	/* Whether the standard input counts. */
+	bool standard_input;
+
+	/* Variable names, whose values in the command's environment count. */
+	const char **env_names;
+	size_t n_env_names;
+
+	/* Files whose contents count. */
+	const char **content_files;
+	size_t n_content_files;
+
+	/* Files whose size, mtime and inode count, for a cheaper check. */
+	const char **mtime_files;
+	size_t n_mtime_files;
+};
+
+/**
+ * memo_run() - replay a command's cached result, or run it and cache it
+ *
+ * The command reads from builtin_input_fd.  When the standard input
+ * is one of @inputs, it is read to the end first, to be part of the
+ * key, and the command reads the copy.  The command's output goes to
+ * the builtin output, and then standard error.  A command killed by a
+ * signal is not cached.
+ *
+ * @argv:       The command and its arguments, NULL terminated.
+ * @envp:       The environment for the command.
+ * @inputs:     The declared inputs.
+ *
+ * Return: the command's exit status, or 127 if it was not found.
+ */
+int memo_run(const char *const argv[], char *const envp[],
+	     const struct memo_inputs *inputs);
+
+/**
+ * memo_usage() - measure the store
+ *
+ * Return: the store's path, or NULL if it could not be opened, in
+ * which case @entries and @bytes are zero.
+ */
+const char *memo_usage(uint64_t *entries, uint64_t *bytes);
+
+/**
+ * memo_max_size() - get the size the store is trimmed to
+ */
+uint64_t memo_max_size(void);
+
+/**
+ * memo_clear() - remove every entry in the store
+ *
+ * Return: zero on success, or -1 on failure.
+ */
+int memo_clear(void);
+
+#endif /* _MEMO_H */
@@ -0,0 +1,39 @@
+#ifndef _OPTIONS_H
+#define _OPTIONS_H
+
+#include <stdbool.h>
+
+/**
+ * Shell options, toggled with "set -o NAME" and "set +o NAME".
+ */
+enum shell_option {
+	/*
+	 * Stop executing the remaining lines of a bracketed paste as
+	 * soon as one of them returns non-zero.
+	 */
+	SHELL_OPTION_PASTE_ERREXIT,
+
+	SHELL_OPTION_COUNT,
+};
+
+/**
+ * The current value of each option, indexed by "enum shell_option".
+ */
+extern bool shell_options[SHELL_OPTION_COUNT];
+
+/**
+ * This array can be used to translate an "enum shell_option" to the
+ * name accepted by the "set" builtin.
+ */
+extern const char *shell_option_names[SHELL_OPTION_COUNT];
+
+/**
+ * shell_option_lookup() - find an option by name
+ *
+ * @name:   The option name, as given to "set -o".
+ *
+ * Return: the matching option, or -1 if there is no such option.
+ */
+int shell_option_lookup(const char *name);
+
+#endif /* _OPTIONS_H */
@@ -0,0 +1,88 @@
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Buffered output for builtin commands.
+ *
+ * Builtins format their standard output into one large, reused
+ * buffer rather than through stdio.  The buffer is written out with
+ * writev() when it fills, alongside any write too large to fit, and
+ * once more after the builtin returns.  Writing to the fd set by
+ * bout_set_fd() lets redirections apply to builtins without touching
+ * the shell's own standard output.  The buffer and fd are
+ * thread-local, so builtins running concurrently in a pipeline each
+ * write to their own stage.
+ */
+
+/**
+ * bout_set_fd() - set the fd builtin output is written to
+ *
+ * Any buffered output is flushed to the previous fd first.
+ *
+ * @fd:   The new output fd.  STDOUT_FILENO is the default.
+ */
+void bout_set_fd(int fd);
+
+/**
+ * bout_fd() - get the fd builtin output is written to
+ */
+int bout_fd(void);
+
+/**
+ * bout_write() - write bytes to the builtin output
+ */
+void bout_write(const char *data, size_t len);
+
+/**
+ * bout_puts() - write a string to the builtin output
+ *
+ * Unlike puts(3), no newline is appended.
+ */
+void bout_puts(const char *str);
+
+/**
+ * bout_printf() - write formatted text to the builtin output
+ */
+void bout_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * bout_copy_fd() - copy part of a file to the builtin output
+ *
+ * Anything buffered is written first.  The data is copied with
+ * sendfile(), so it never passes through the buffer.
+ *
+ * @fd:       The file to copy from.  Its offset is not changed.
+ * @offset:   Where in the file to start.
+ * @len:      The number of bytes to copy.
+ */
+void bout_copy_fd(int fd, off_t offset, uint64_t len);
+
+/**
+ * bout_flush() - write out any buffered builtin output
+ *
+ * Return: zero on success, or -1 with errno set if any write since
+ * the last flush failed.  Output written after a failure is
+ * discarded.
+ */
+int bout_flush(void);
+
+/**
+ * fd_copy() - copy part of one file to another fd
+ *
+ * This uses sendfile(), falling back to pread() and write() for fds
+ * it does not support.
+ *
+ * @out_fd:   The fd to write to, at its current offset.
+ * @in_fd:    The file to copy from.  Its offset is not changed.
+ * @offset:   Where in @in_fd to start.
+ * @len:      The number of bytes to copy.
+ *
+ * Return: zero on success, or -1 with errno set on failure.
+ */
+int fd_copy(int out_fd, int in_fd, off_t offset, uint64_t len);
+
+#endif /* _OUTPUT_H */
@@ -0,0 +1,47 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stddef.h>
+
+/* What "parallel" does once a job fails. */
+enum parallel_halt {
+	/* Run every job, and fail if any did. */
+	PARALLEL_HALT_NEVER,
+	/* Start no more jobs, but let the running ones finish. */
+	PARALLEL_HALT_SOON,
+	/* Kill the running jobs with SIGTERM, and stop. */
+	PARALLEL_HALT_NOW,
+};
+
+/* The most jobs "parallel" may be asked to run at once. */
+#define PARALLEL_MAX_JOBS 4096
+
+struct parallel_options {
+	/* The most jobs to run at once, from 1 to PARALLEL_MAX_JOBS. */
+	size_t max_jobs;
+	enum parallel_halt halt;
+};
+
+/**
+ * parallel_run() - run a command once per item, several at a time
+ *
+ * Each job is the @template with every "{}" in it replaced by the
+ * item, or with the item appended when there is no "{}".  Jobs are
+ * started with spawn_command(), with their standard output and error
+ * captured in memfds.  Their outputs are written to the builtin
+ * output and standard error in the order of the items, each job's
+ * in one piece, however the jobs finish.
+ *
+ * @template:   The command, NULL terminated.
+ * @items:      The items, NULL terminated, or NULL to read them from
+ *              the lines of builtin_input_fd as the jobs run.
+ * @opts:       The options.
+ *
+ * Return: zero if every job succeeded.  Otherwise, with
+ * PARALLEL_HALT_NEVER, the number of failed jobs, up to 101, or
+ * the exit status of the job which caused the halt.
+ */
+int parallel_run(const char *const template[], const char *const items[],
+		 const struct parallel_options *opts);
+
+#endif /* _PARALLEL_H */
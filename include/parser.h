@@ -1,6 +1,8 @@
 #ifndef _PARSER_H
 #define _PARSER_H
 
+#include <stdbool.h>
+
 /**
  * The maximum number of arguments supported by the parser, including
  * room for the NULL terminator.  Note: this is not a limitation of
@@ -11,11 +13,36 @@
 
 enum command_output_type {
 	COMMAND_OUTPUT_STDOUT,
-	COMMAND_OUTPUT_FILE_TRUNCATE,
-	COMMAND_OUTPUT_FILE_APPEND,
 	COMMAND_OUTPUT_PIPE,
 };
 
+enum redirection_type {
+	REDIRECTION_INPUT,
+	REDIRECTION_TRUNCATE,
+	REDIRECTION_APPEND,
+	REDIRECTION_DUP,
+	REDIRECTION_CLOSE,
+};
+
+/**
+ * A redirection of a file descriptor.
+ *
+ * REDIRECTION_INPUT, REDIRECTION_TRUNCATE, REDIRECTION_APPEND:
+ *     "N<file", "N>file" and "N>>file".  Open filename onto fd.
+ *     Without N, fd is stdin for "<" and stdout for the others.
+ * REDIRECTION_DUP:
+ *     "N>&M" or "N<&M".  Make fd a copy of source_fd.  Without N,
+ *     fd is stdout for ">&" and stdin for "<&".
+ * REDIRECTION_CLOSE:
+ *     "N>&-" or "N<&-".  Close fd.
+ */
+struct redirection {
+	int fd;
+	enum redirection_type type;
+	char *filename;
+	int source_fd;
+};
+
 /**
  * The result of parsing a command.  This linked-list structure
  * represents a pipeline of commands.  See the comments below for
@@ -26,34 +53,38 @@ struct command {
 	char *argv[ARGS_MAX];
 
 	/*
-	 * The input file, or NULL if none.
-	 * Note: it is not valid to have an input file on the
-	 * receiving end of a pipe.
+	 * The "NAME=value" words before the command name, NULL
+	 * terminated.  These are added to the environment of this
+	 * command only, and do not change the shell's variables.
 	 */
-	char *input_filename;
+	char *assignments[ARGS_MAX];
 
 	/*
 	 * The output type.
 	 *
 	 * COMMAND_OUTPUT_STDOUT:
-	 *     Output to the terminal.
-	 * COMMAND_OUTPUT_FILE_TRUNCATE:
-	 *     Output to the file specified by output_filename.
-	 *     Overwrite any existing contents.
-	 * COMMAND_OUTPUT_FILE_APPEND:
-	 *     Output to the file specified by output_filename.
-	 *     Append to any existing contents.
+	 *     Output to the shell's stdout.
 	 * COMMAND_OUTPUT_PIPE:
 	 *     Forward the output to the input of the command
 	 *     specified by pipe_to.
 	 */
 	enum command_output_type output_type;
-	union {
-		/* When COMMAND_OUTPUT_FILE_*, this is set. */
-		char *output_filename;
-		/* When COMMAND_OUTPUT_PIPE, this is set. */
-		struct command *pipe_to;
-	};
+	/* When COMMAND_OUTPUT_PIPE, this is set. */
+	struct command *pipe_to;
+
+	/*
+	 * The redirections, including plain "<" and ">", in the order
+	 * given.  They are applied in that order, after the pipes, so
+	 * "cmd 2>&1 >file | next" sends stderr down the pipe.
+	 */
+	struct redirection *redirections;
+	size_t n_redirections;
+
+	/*
+	 * Set on every command of a pipeline which ends with "&", to
+	 * run it in the background as a job.
+	 */
+	bool background;
 };
 
 /**
@@ -66,10 +97,11 @@ struct command {
 enum parse_error {
 	PARSE_SUCCESS,
 	PARSE_ERR_COMMAND_WITHOUT_ARGS,
-	PARSE_ERR_MULTIPLE_INPUTS,
-	PARSE_ERR_MULTIPLE_OUTPUTS,
 	PARSE_ERR_MISSING_ARG_TO_FILE_OP,
 	PARSE_ERR_TOO_MANY_ARGS,
+	PARSE_ERR_UNTERMINATED_QUOTE,
+	PARSE_ERR_BAD_FD_REDIRECTION,
+	PARSE_ERR_MISPLACED_AMPERSAND,
 };
 
 /**
@@ -0,0 +1,41 @@
+#ifndef _PATHCACHE_H
+#define _PATHCACHE_H
+
+/*
+ * A cache of where commands were found in the PATH, so running a
+ * command does not search every PATH directory each time.  The cache
+ * is emptied whenever the value of PATH changes.  It may be used from
+ * any thread.
+ */
+
+/**
+ * path_lookup() - find the executable a command name refers to
+ *
+ * Names containing a slash are returned as they are.  Otherwise, a
+ * cached result is used if that file is still executable, and the
+ * PATH is searched if not.
+ *
+ * @name:   The command name.
+ *
+ * Return: the newly allocated path of the executable, or NULL if none
+ * was found.
+ */
+char *path_lookup(const char *name);
+
+/**
+ * path_lookup_all() - find every executable in the PATH called @name
+ *
+ * This makes one pass over the PATH directories, and caches the first
+ * match as path_lookup() would.
+ *
+ * Return: a newly allocated, NULL-terminated array of newly allocated
+ * paths, in PATH order.
+ */
+char **path_lookup_all(const char *name);
+
+/**
+ * path_cache_clear() - forget all cached command locations
+ */
+void path_cache_clear(void);
+
+#endif /* _PATHCACHE_H */
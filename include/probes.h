@@ -0,0 +1,39 @@
+#ifndef _PROBES_H
+#define _PROBES_H
+
+/*
+ * Static tracepoints, under the provider "shell", for bpftrace, perf
+ * and systemtap.  util/shell-probes.bt shows how to use them.
+ *
+ * With <sys/sdt.h>, each probe is a single nop in the code, and a note
+ * in the binary says where it is and where to find its arguments, so
+ * a probe costs nothing until a tracer attaches to it.  Without the
+ * header, or with NO_PROBES defined, the probes compile to nothing.
+ *
+ * parse_start(input), parse_end(input, error):
+ *     Around parse_input().  error is an "enum parse_error".
+ * spawn_start(command), spawn_end(command, pid):
+ *     Around forking a stage.  pid is -1 if the fork failed.
+ * exec_failed(command, errno):
+ *     In the child, when a command is not found or cannot be exec'd.
+ * child_reap(pid, status):
+ *     When a child is reaped.  status is as returned by waitpid().
+ */
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+#define PROBE1(name, a) STAP_PROBE1(shell, name, a)
+#define PROBE2(name, a, b) STAP_PROBE2(shell, name, a, b)
+#else
+/* The arguments are not evaluated, but still count as used. */
+#define PROBE1(name, a) ((void)sizeof(a))
+#define PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#endif
+
+#endif /* _PROBES_H */
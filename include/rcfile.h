@@ -0,0 +1,30 @@
+#ifndef _RCFILE_H
+#define _RCFILE_H
+
+#include <stdbool.h>
+
+/**
+ * load_rc_file() - run ~/.shellrc, or restore its cached result
+ *
+ * The first time the rc file is run, the shell state it leaves
+ * behind (the shell options, and the variables it sets or unsets) is
+ * written to a binary snapshot at ~/.shellrc.snap.  Later shells mmap
+ * the snapshot and apply it directly, without parsing the rc file,
+ * for as long as the rc file's mtime, size and inode are unchanged.
+ *
+ * A snapshot is only written when every line of the rc file is a
+ * builtin which just sets shell state, without printing anything, and
+ * succeeds.  Rc files which run anything else, such as external
+ * commands, "cd" or a bare "set", are always run in full.
+ *
+ * @dispatcher:         The callback function to execute each line.
+ * @shell_should_exit:  Output parameter, as for the dispatcher.
+ *
+ * Return: the return value of the last line of the rc file, or zero
+ * if there is no rc file or it was restored from the snapshot.
+ */
+int load_rc_file(int (*dispatcher)(const char *line, int last_rv,
+				   bool *shell_should_exit),
+		 bool *shell_should_exit);
+
+#endif /* _RCFILE_H */
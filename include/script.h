@@ -0,0 +1,37 @@
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * run_script() - run each line of a stream through a dispatcher
+ *
+ * Lines are read one at a time into a single reused buffer, so memory
+ * use is bounded by the longest line rather than the size of the
+ * script.  While a line runs, script_print_position() reports it by
+ * @name and line number.  Scripts may be nested, as with "source".
+ *
+ * @stream:             The script to run.
+ * @name:               The name of the script, for error messages.
+ * @last_rv:            The return value of the previous command.
+ * @dispatcher:         The callback function to execute each line.
+ * @shell_should_exit:  Output parameter, as for the dispatcher.  The
+ *                      script stops once it is set.
+ *
+ * Return: the return value of the last line dispatched.
+ */
+int run_script(FILE *stream, const char *name, int last_rv,
+	       int (*dispatcher)(const char *line, int last_rv,
+				 bool *shell_should_exit),
+	       bool *shell_should_exit);
+
+/**
+ * script_print_position() - print where in a script the shell is
+ *
+ * If a script line is running, this prints "NAME:LINE: " to @stream,
+ * as a prefix for an error message.  Otherwise, it prints nothing.
+ */
+void script_print_position(FILE *stream);
+
+#endif /* _SCRIPT_H */
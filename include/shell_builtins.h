@@ -3,8 +3,33 @@
 
 #include <stdbool.h>
 
+/*
+ * Flags for a builtin command.
+ *
+ * BUILTIN_STATEFUL:
+ *     The builtin changes the state of the shell.  When it is part of
+ *     a longer pipeline, it runs in a forked child so the changes are
+ *     discarded, as in other shells.  Other builtins in a pipeline run
+ *     in-process, on a thread of their own.
+ *
+ * BUILTIN_PERSISTENT_REDIRECTIONS:
+ *     When the builtin is run with no arguments as the only stage of
+ *     a pipeline, its redirections are applied to the shell's own fds
+ *     and left in place afterwards, as for "exec >log".  With
+ *     arguments, the builtin is run with its redirections applied to
+ *     the shell's fds, rather than through builtin_input_fd and the
+ *     buffered output layer, and they are undone if it returns.
+ */
+#define BUILTIN_STATEFUL (1 << 0)
+#define BUILTIN_PERSISTENT_REDIRECTIONS (1 << 1)
+
 /**
  * A builtin command.
+ *
+ * Builtins may run on a thread other than the main one, with their
+ * standard input and output connected to a pipeline.  They must read
+ * their input from builtin_input_fd, and write their output with the
+ * functions in output.h, rather than using stdin and stdout.
  */
 struct builtin_command {
 	/* The name of the command to match argv[0]. */
@@ -13,11 +38,47 @@ struct builtin_command {
 	/* The handler function. */
 	int (*handler)(const char *const argv[], int last_rv,
 		       bool *shell_should_exit);
+
+	/* BUILTIN_* flags. */
+	unsigned int flags;
 };
 
+/**
+ * The fd the running builtin should read its input from.  This is
+ * thread-local, and is only changed while the builtin runs.
+ */
+extern _Thread_local int builtin_input_fd;
+
+/**
+ * Whether builtin_input_fd was piped or redirected for the running
+ * builtin.  When it was not, it is the shell's own input, which may
+ * be the rest of the script the shell is reading.
+ */
+extern _Thread_local bool builtin_input_redirected;
+
+/**
+ * The environment for commands the running builtin starts, including
+ * any prefix assignments given to it.  This is thread-local, and is
+ * NULL when no builtin is running.
+ */
+extern _Thread_local char *const *builtin_envp;
+
 /**
  * The global list of builtin commands.
  */
 extern struct builtin_command builtin_commands[];
 
+/**
+ * find_builtin() - look up a builtin command by name
+ *
+ * The lookup uses a perfect hash of the names in builtin_commands[],
+ * generated at build time by util/gen_builtin_hash, so it costs one
+ * hash and one string comparison however many builtins there are.
+ *
+ * @name:   The command name, i.e. argv[0].
+ *
+ * Return: the builtin, or NULL if @name is not a builtin.
+ */
+const struct builtin_command *find_builtin(const char *name);
+
 #endif /* _SHELL_BUILTINS_H */
@@ -0,0 +1,117 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Internal performance counters, as printed by "shellstats".
+ *
+ * Each thread counts into its own struct shell_stats, which is only
+ * ever written by that thread and is aligned to a cache line, so
+ * counting is a plain load and store with no lock and no sharing.
+ * stats_collect() sums every thread's counters when they are read.
+ */
+
+/*
+ * Histograms have power-of-two buckets of microseconds: bucket 0 is
+ * under 1us, bucket i is [2^(i-1), 2^i) us, and the last bucket holds
+ * everything longer.
+ */
+#define STATS_HIST_BUCKETS 20
+
+struct shell_stats {
+	/* Non-empty lines run by the dispatcher. */
+	uint64_t commands;
+	/* Processes forked, and the external commands among them. */
+	uint64_t forks;
+	uint64_t execs;
+	/* Builtins run, and those run on a pipeline thread. */
+	uint64_t builtin_runs;
+	uint64_t builtin_threads;
+	/* Time spent waiting for pipeline stages to finish. */
+	uint64_t wait_ns;
+	uint64_t path_cache_hits;
+	uint64_t path_cache_misses;
+	uint64_t cdpath_cache_hits;
+	uint64_t cdpath_cache_misses;
+	/* Commands "memo" replayed from its store, or had to run. */
+	uint64_t memo_hits;
+	uint64_t memo_misses;
+	/* Time taken by parse_input(). */
+	uint64_t parse_hist[STATS_HIST_BUCKETS];
+	/* Time taken to fork a pipeline stage, as seen by the shell. */
+	uint64_t spawn_hist[STATS_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+/* This thread's counters, or NULL until it first counts something. */
+extern _Thread_local struct shell_stats *stats_local;
+
+/**
+ * stats_register() - allocate and register this thread's counters
+ *
+ * Return: the counters, which are also stored in stats_local.
+ */
+struct shell_stats *stats_register(void);
+
+/**
+ * stats_thread_exit() - retire this thread's counters
+ *
+ * The counts are added to a total kept for finished threads, so they
+ * are not lost.  Call this before a thread which has counted
+ * anything exits.
+ */
+void stats_thread_exit(void);
+
+/**
+ * stats_collect() - sum the counters of every thread
+ *
+ * @total:  Output parameter for the sums.
+ */
+void stats_collect(struct shell_stats *total);
+
+static inline struct shell_stats *stats_self(void)
+{
+	return stats_local ? stats_local : stats_register();
+}
+
+/**
+ * stats_add() - add to one of this thread's counters
+ *
+ * Only the owning thread writes a counter, so there is no need for
+ * a locked add.  The relaxed atomics only keep stats_collect(),
+ * which may read from another thread, from seeing a torn value.
+ */
+static inline void stats_add(uint64_t *counter, uint64_t n)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+			 __ATOMIC_RELAXED);
+}
+
+#define STATS_INC(field) stats_add(&stats_self()->field, 1)
+
+static inline uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * stats_hist_add() - count a duration in one of this thread's histograms
+ *
+ * @hist:   The histogram, such as stats_self()->parse_hist.
+ * @ns:     The duration.
+ */
+static inline void stats_hist_add(uint64_t *hist, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	if (bucket >= STATS_HIST_BUCKETS)
+		bucket = STATS_HIST_BUCKETS - 1;
+	stats_add(&hist[bucket], 1);
+}
+
+#endif /* _STATS_H */
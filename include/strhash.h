@@ -0,0 +1,31 @@
+#ifndef _STRHASH_H
+#define _STRHASH_H
+
+#include <stdint.h>
+
+/**
+ * strhash() - hash a string
+ *
+ * 32-bit FNV-1a, with @seed mixed into the offset basis and a final
+ * avalanche so the low bits can be used as a table index.  This is
+ * shared by the shell and util/gen_builtin_hash, which must agree on
+ * it exactly.
+ *
+ * @str:    The NUL-terminated string to hash.
+ * @seed:   The seed.
+ */
+static inline uint32_t strhash(const char *str, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	for (; *str; str++) {
+		h ^= (unsigned char)*str;
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h;
+}
+
+#endif /* _STRHASH_H */
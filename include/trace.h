@@ -0,0 +1,52 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Phase tracing, as dumped by the "trace" builtin.
+ *
+ * Each phase of running a command (reading the line, expanding it,
+ * parsing it, finding and starting each stage, and waiting for it) is
+ * recorded as a span with monotonic start and end times, in a ring of
+ * the most recent TRACE_RING_SIZE spans.
+ *
+ * Recording takes no lock: a writer claims a slot with an atomic
+ * increment, and marks it complete with a sequence number once it has
+ * been filled in, which readers check before and after copying it.
+ * The ring is in shared memory, so forked children record into the
+ * same ring as the shell.
+ */
+
+#define TRACE_RING_SIZE 4096
+
+/* How much of a span's detail, such as a command name, is kept. */
+#define TRACE_DETAIL_MAX 48
+
+/**
+ * trace_span() - record a phase which started at @start_ns and ends now
+ *
+ * @name:       The phase.  This must be a string literal.
+ * @start_ns:   When it started, from stats_now_ns().
+ * @detail:     What it was for, such as the command, or NULL.
+ * @arg_name:   The name of @arg, such as "pid", or NULL if there is
+ *              none.  This must be a string literal.
+ * @arg:        A number to record with the span.
+ */
+void trace_span(const char *name, uint64_t start_ns, const char *detail,
+		const char *arg_name, long arg);
+
+/**
+ * trace_dump() - write the ring to the builtin output as a trace
+ *
+ * The spans are written in the Chrome trace event format, which
+ * Perfetto and chrome://tracing can load, oldest first.
+ */
+void trace_dump(void);
+
+/**
+ * trace_clear() - forget every span recorded so far
+ */
+void trace_clear(void);
+
+#endif /* _TRACE_H */
@@ -0,0 +1,97 @@
+#ifndef _VARIABLES_H
+#define _VARIABLES_H
+
+#include <stdbool.h>
+
+/*
+ * Shell variables.
+ *
+ * The shell owns its variables, rather than using setenv(3) on its
+ * own environment.  The table is filled from the environment the
+ * shell was started with, and those variables start out exported.
+ *
+ * The environment passed to children, returned by var_envp(), is
+ * kept up to date as exported variables change: setting one swaps a
+ * single pointer in the array, so nothing is rebuilt or copied when
+ * a command is run.
+ */
+
+/* Flags for var_set(). */
+#define VAR_EXPORT (1 << 0)
+
+/**
+ * var_name_valid() - check whether a string is a valid variable name
+ *
+ * Names are a letter or underscore, followed by any number of
+ * letters, digits and underscores.
+ */
+bool var_name_valid(const char *name);
+
+/**
+ * var_get() - get the value of a variable
+ *
+ * Return: the value, or NULL if the variable is not set.  The value
+ * remains valid until the variable is next changed.
+ */
+const char *var_get(const char *name);
+
+/**
+ * var_set() - set the value of a variable
+ *
+ * A variable which is already exported stays exported.
+ *
+ * @name:    The variable name.
+ * @value:   The new value.
+ * @flags:   VAR_EXPORT to also export the variable.
+ *
+ * Return: zero on success, or -1 if @name is not a valid name.
+ */
+int var_set(const char *name, const char *value, int flags);
+
+/**
+ * var_export() - export a variable, or stop exporting it
+ *
+ * Exporting a variable which is not set does nothing.
+ *
+ * Return: zero on success, or -1 if @name is not a valid name.
+ */
+int var_export(const char *name, bool exported);
+
+/**
+ * var_unset() - unset a variable
+ *
+ * Return: zero on success, or -1 if @name is not a valid name.
+ */
+int var_unset(const char *name);
+
+/**
+ * var_envp() - get the environment for child processes
+ *
+ * Return: a NULL-terminated array of "NAME=VALUE" strings for the
+ * exported variables, in no particular order.  It remains valid
+ * until a variable is next changed.
+ */
+char *const *var_envp(void);
+
+/**
+ * var_envp_with() - get the environment for a child, with overrides
+ *
+ * This is a copy of var_envp(), with each of @assignments replacing
+ * the exported variable of the same name, or added if there is none.
+ * The shell's own variables are not changed.
+ *
+ * @assignments:  A NULL-terminated array of "NAME=VALUE" strings.
+ *
+ * Return: a newly allocated NULL-terminated array, which should be
+ * passed to free().  The strings in it are not copied.
+ */
+char **var_envp_with(char *const assignments[]);
+
+/**
+ * Called after each change to a variable, or NULL.  @value is NULL
+ * when the variable was unset.
+ */
+extern void (*var_change_hook)(const char *name, const char *value,
+			       bool exported);
+
+#endif /* _VARIABLES_H */
@@ -0,0 +1,61 @@
+#ifndef _WORKDIR_H
+#define _WORKDIR_H
+
+#include <stdbool.h>
+
+/*
+ * The shell's working directory.
+ *
+ * The shell tracks the current directory logically, as the path used
+ * to reach it, including any symbolic links, rather than asking the
+ * kernel with getcwd(3) each time.  The PWD and OLDPWD variables are
+ * kept up to date as it changes.
+ */
+
+/**
+ * workdir_get() - get the logical current directory
+ *
+ * The first time this is called, $PWD is used if it is an absolute
+ * path without "." or ".." components naming the current directory,
+ * and getcwd(3) otherwise.
+ *
+ * Return: the path, which remains valid until the directory next
+ * changes, or NULL if it could not be found.
+ */
+const char *workdir_get(void);
+
+/**
+ * workdir_change() - change the current directory
+ *
+ * @dir:        The directory.  A relative path is taken relative to
+ *              the logical current directory.
+ * @physical:   Resolve symbolic links, so the new logical directory
+ *              is the physical one, as for "cd -P".  Otherwise, ".."
+ *              removes the previous component of the logical path.
+ *
+ * Return: zero on success, or -1 with errno set on failure.
+ */
+int workdir_change(const char *dir, bool physical);
+
+/**
+ * cdpath_lookup() - find a directory for cd through $CDPATH
+ *
+ * Names starting with "/", "." or ".." are not searched for.  The
+ * absolute CDPATH entry each name was found in is cached, and the
+ * cache is emptied whenever the value of CDPATH changes.  A cached
+ * entry is used as long as the directory is still there, and the
+ * entries before it are the same directories, unmodified, as when
+ * the name was not found in them.  A match in an empty, "." or other
+ * relative entry depends on the current directory, and is not cached.
+ *
+ * @name:           The argument given to cd.
+ * @from_cdpath:    Output parameter, set when @name was found through
+ *                  a non-empty CDPATH entry, so cd should print the
+ *                  new directory.
+ *
+ * Return: the newly allocated directory to change to, which is @name
+ * itself when it was not found in the CDPATH.
+ */
+char *cdpath_lookup(const char *name, bool *from_cdpath);
+
+#endif /* _WORKDIR_H */
@@ -13,6 +13,14 @@ static char *get_prompt(int last_rv)
 	return strdup("parseview> ");
 }
 
+static const char *redirection_type_str[] = {
+	[REDIRECTION_INPUT] = "REDIRECTION_INPUT",
+	[REDIRECTION_TRUNCATE] = "REDIRECTION_TRUNCATE",
+	[REDIRECTION_APPEND] = "REDIRECTION_APPEND",
+	[REDIRECTION_DUP] = "REDIRECTION_DUP",
+	[REDIRECTION_CLOSE] = "REDIRECTION_CLOSE",
+};
+
 static void ntabs(int num_tabs)
 {
 	for (int i = 0; i < num_tabs; i++)
@@ -66,11 +74,45 @@ static void dump_cmd(struct command *cmd, int level)
 	ntabs(level + 1);
 	printf("},\n");
 
-	/* input_file */
+	/* assignments */
+	ntabs(level + 1);
+	printf(".assignments = {\n");
+	ntabs(level + 2);
+	for (int i = 0; cmd->assignments[i]; i++) {
+		dump_str(cmd->assignments[i]);
+		printf(", ");
+	}
+	printf("NULL,\n");
+	ntabs(level + 1);
+	printf("},\n");
+
+	/* redirections */
+	ntabs(level + 1);
+	printf(".redirections = {\n");
+	for (size_t i = 0; i < cmd->n_redirections; i++) {
+		struct redirection *r = &cmd->redirections[i];
+
+		ntabs(level + 2);
+		printf("{ .fd = %d, .type = %s, ", r->fd,
+		       redirection_type_str[r->type]);
+		if (r->type == REDIRECTION_DUP) {
+			printf(".source_fd = %d },\n", r->source_fd);
+		} else if (r->type == REDIRECTION_CLOSE) {
+			printf("},\n");
+		} else {
+			printf(".filename = ");
+			dump_str(r->filename);
+			printf(" },\n");
+		}
+	}
 	ntabs(level + 1);
-	printf(".input_filename = ");
-	dump_str(cmd->input_filename);
-	printf(",\n");
+	printf("},\n");
+
+	/* background */
+	if (cmd->background) {
+		ntabs(level + 1);
+		printf(".background = true,\n");
+	}
 
 	/* output_type */
 	ntabs(level + 1);
@@ -79,12 +121,6 @@ static void dump_cmd(struct command *cmd, int level)
 	case COMMAND_OUTPUT_STDOUT:
 		printf("COMMAND_OUTPUT_STDOUT,\n");
 		break;
-	case COMMAND_OUTPUT_FILE_TRUNCATE:
-		printf("COMMAND_OUTPUT_TRUNCATE,\n");
-		break;
-	case COMMAND_OUTPUT_FILE_APPEND:
-		printf("COMMAND_OUTPUT_APPEND,\n");
-		break;
 	case COMMAND_OUTPUT_PIPE:
 		printf("COMMAND_OUTPUT_PIPE,\n");
 		break;
@@ -94,11 +130,6 @@ static void dump_cmd(struct command *cmd, int level)
 		ntabs(level + 1);
 		printf(".pipe_to = &");
 		dump_cmd(cmd->pipe_to, level + 1);
-	} else if (cmd->output_type != COMMAND_OUTPUT_STDOUT) {
-		ntabs(level + 1);
-		printf(".output_filename = ");
-		dump_str(cmd->output_filename);
-		printf(",\n");
 	}
 	ntabs(level);
 	printf("}%s\n", level ? "," : "");
@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dispatcher.h"
+
+/* A line of a recording made with "shell -r". */
+struct record {
+	long long start_ns;
+	long long duration_ns;
+	int rv;
+	char *cwd;
+	char *line;
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-q] recording\n", argv0);
+	fprintf(stderr, "  -q  discard the output of replayed commands\n");
+}
+
+/**
+ * unescape_field() - undo the escaping of a recorded field, in place
+ *
+ * Return: @field.
+ */
+static char *unescape_field(char *field)
+{
+	char *in = field, *out = field;
+
+	for (; *in; in++) {
+		if (*in == '\\' && in[1]) {
+			in++;
+			if (*in == 't')
+				*out++ = '\t';
+			else if (*in == 'n')
+				*out++ = '\n';
+			else
+				*out++ = *in;
+		} else {
+			*out++ = *in;
+		}
+	}
+	*out = '\0';
+	return field;
+}
+
+/**
+ * parse_record() - split a recording line into its fields
+ *
+ * The line is modified in place, and the string fields of @rec point
+ * into it.
+ *
+ * Return: true on success, false if the line is malformed.
+ */
+static bool parse_record(char *buf, struct record *rec)
+{
+	char *fields[4];
+
+	buf[strcspn(buf, "\n")] = '\0';
+	for (size_t i = 0; i < 4; i++) {
+		fields[i] = buf;
+		buf = strchr(buf, '\t');
+		if (!buf)
+			return false;
+		*buf++ = '\0';
+	}
+
+	rec->start_ns = strtoll(fields[0], NULL, 10);
+	rec->duration_ns = strtoll(fields[1], NULL, 10);
+	rec->rv = atoi(fields[2]);
+	rec->cwd = unescape_field(fields[3]);
+	rec->line = unescape_field(buf);
+	return true;
+}
+
+static long long monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * quiet_stdout() - send stdout to /dev/null
+ *
+ * Return: a stream for the report, which still goes to the original
+ * stdout, or NULL on failure.
+ */
+static FILE *quiet_stdout(void)
+{
+	int report_fd = dup(STDOUT_FILENO);
+	int null_fd = open("/dev/null", O_WRONLY);
+
+	if (report_fd < 0 || null_fd < 0 ||
+	    dup2(null_fd, STDOUT_FILENO) < 0) {
+		perror("Unable to redirect output to /dev/null");
+		return NULL;
+	}
+	close(null_fd);
+	return fdopen(report_fd, "w");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *recording;
+	FILE *report = stdout;
+	struct record rec;
+	char *buf = NULL;
+	size_t buf_sz = 0;
+	size_t lineno = 0;
+	long long start, elapsed;
+	long long total_recorded = 0, total_replayed = 0;
+	int last_rv = 0;
+	bool shell_should_exit = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "q")) != -1) {
+		switch (opt) {
+		case 'q':
+			report = quiet_stdout();
+			if (!report)
+				return 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	recording = fopen(argv[optind], "r");
+	if (!recording) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	fprintf(report, "%6s %12s %12s %8s  %s\n", "line", "recorded_us",
+		"replay_us", "delta", "command");
+	while (!shell_should_exit && getline(&buf, &buf_sz, recording) > 0) {
+		lineno++;
+		if (!parse_record(buf, &rec)) {
+			fprintf(stderr, "%s:%zu: malformed record\n",
+				argv[optind], lineno);
+			continue;
+		}
+		if (chdir(rec.cwd) < 0)
+			fprintf(stderr, "%s:%zu: cd %s: %s\n", argv[optind],
+				lineno, rec.cwd, strerror(errno));
+
+		fflush(report);
+		start = monotonic_ns();
+		last_rv = shell_command_dispatcher(rec.line, last_rv,
+						   &shell_should_exit);
+		elapsed = monotonic_ns() - start;
+
+		total_recorded += rec.duration_ns;
+		total_replayed += elapsed;
+		fprintf(report, "%6zu %12lld %12lld %+7.1f%%  %s", lineno,
+			rec.duration_ns / 1000, elapsed / 1000,
+			rec.duration_ns ? 100.0 * (elapsed - rec.duration_ns) /
+						  rec.duration_ns :
+					  0.0,
+			rec.line);
+		if (last_rv != rec.rv)
+			fprintf(report, "  [rv %d, recorded %d]", last_rv,
+				rec.rv);
+		fprintf(report, "\n");
+	}
+
+	fprintf(report, "%6s %12lld %12lld %+7.1f%%\n", "total",
+		total_recorded / 1000, total_replayed / 1000,
+		total_recorded ? 100.0 * (total_replayed - total_recorded) /
+					 total_recorded :
+				 0.0);
+
+	free(buf);
+	fclose(recording);
+	fclose(report);
+	return 0;
+}
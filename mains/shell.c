@@ -1,7 +1,42 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
 #include "interact.h"
 #include "dispatcher.h"
+#include "rcfile.h"
 
 int main(int argc, char *argv[])
 {
+	bool read_rc = true;
+	bool shell_should_exit = false;
+	int rv;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:nr:")) != -1) {
+		switch (opt) {
+		case 'e':
+			if (interact_set_line_editor(optarg) < 0)
+				return 1;
+			break;
+		case 'n':
+			read_rc = false;
+			break;
+		case 'r':
+			if (interact_record(optarg) < 0)
+				return 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-e editor] [-n] [-r recording]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (read_rc) {
+		rv = load_rc_file(shell_command_dispatcher, &shell_should_exit);
+		if (shell_should_exit)
+			return rv;
+	}
+
 	return interact(default_prompt_generator, shell_command_dispatcher);
 }
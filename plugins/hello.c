@@ -0,0 +1,25 @@
+/*
+ * An example loadable builtin.  Load it into a running shell with:
+ *
+ *    enable -f build/plugins/hello.so hello
+ *
+ * A loadable builtin is a shared object defining a "struct
+ * builtin_command" named after the builtin, with "_builtin"
+ * appended.  Output should go through the functions in output.h, so
+ * it honors redirections like any other builtin.
+ */
+#include <stdbool.h>
+
+#include "output.h"
+#include "shell_builtins.h"
+
+static int hello(const char *const argv[], int last_rv, bool *unused)
+{
+	bout_puts("Hello");
+	for (size_t i = 1; argv[i]; i++)
+		bout_printf("%s %s", i > 1 ? "," : "", argv[i]);
+	bout_puts("!\n");
+	return 0;
+}
+
+struct builtin_command hello_builtin = { "hello", hello };
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "dispatcher.h"
+#include "output.h"
+#include "shell_builtins.h"
+
+/*
+ * Runs whose modified z-score, based on the median absolute deviation,
+ * is above this are outliers.
+ */
+#define OUTLIER_THRESHOLD 3.5
+
+/* The results of timing one command line, in seconds. */
+struct bench_result {
+	const char *cmd;
+	double *wall;
+	size_t n;
+	double user;
+	double sys;
+	double mean;
+	double stddev;
+	unsigned int failures;
+};
+
+static double timeval_secs(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double rusage_diff(const struct rusage *before,
+			  const struct rusage *after, bool user)
+{
+	return user ? timeval_secs(&after->ru_utime) -
+			      timeval_secs(&before->ru_utime) :
+		      timeval_secs(&after->ru_stime) -
+			      timeval_secs(&before->ru_stime);
+}
+
+/**
+ * run_once() - run a command line, and measure it
+ *
+ * Both the shell's own usage, for builtins, and its children's, for
+ * everything else, are counted.
+ *
+ * Return: the return status of the command line.
+ */
+static int run_once(const char *cmd, double *wall, double *user,
+		    double *sys)
+{
+	struct rusage self0, self1, child0, child1;
+	struct timespec start, end;
+	bool shell_should_exit = false;
+	int rv;
+
+	getrusage(RUSAGE_SELF, &self0);
+	getrusage(RUSAGE_CHILDREN, &child0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	rv = shell_command_dispatcher(cmd, 0, &shell_should_exit);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	getrusage(RUSAGE_CHILDREN, &child1);
+	getrusage(RUSAGE_SELF, &self1);
+
+	*wall = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	*user = rusage_diff(&self0, &self1, true) +
+		rusage_diff(&child0, &child1, true);
+	*sys = rusage_diff(&self0, &self1, false) +
+	       rusage_diff(&child0, &child1, false);
+	return rv;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * percentile() - interpolate the @p quantile of @n sorted values
+ */
+static double percentile(const double *sorted, size_t n, double p)
+{
+	double pos = p * (n - 1);
+	size_t lo = pos;
+
+	if (lo + 1 >= n)
+		return sorted[n - 1];
+	return sorted[lo] + (pos - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+/**
+ * count_outliers() - count runs far from the median
+ *
+ * @sorted:  The wall times, sorted.
+ */
+static size_t count_outliers(const double *sorted, size_t n)
+{
+	double median = percentile(sorted, n, 0.5);
+	double *dev = malloc(n * sizeof(*dev));
+	size_t outliers = 0;
+	double mad;
+
+	for (size_t i = 0; i < n; i++)
+		dev[i] = fabs(sorted[i] - median);
+	qsort(dev, n, sizeof(*dev), compare_doubles);
+	mad = percentile(dev, n, 0.5);
+	free(dev);
+
+	if (mad == 0)
+		return 0;
+	for (size_t i = 0; i < n; i++) {
+		if (0.6745 * fabs(sorted[i] - median) / mad >
+		    OUTLIER_THRESHOLD)
+			outliers++;
+	}
+	return outliers;
+}
+
+/* A unit to print times in, chosen to suit the mean. */
+struct time_unit {
+	const char *name;
+	double scale;
+};
+
+static struct time_unit unit_for(double secs)
+{
+	if (secs >= 1)
+		return (struct time_unit){ "s", 1 };
+	if (secs >= 1e-3)
+		return (struct time_unit){ "ms", 1e3 };
+	return (struct time_unit){ "us", 1e6 };
+}
+
+static void print_result(size_t index, struct bench_result *r)
+{
+	struct time_unit u = unit_for(r->mean);
+	static const double pcts[] = { 0.5, 0.9, 0.95, 0.99 };
+	size_t outliers;
+
+	qsort(r->wall, r->n, sizeof(*r->wall), compare_doubles);
+	outliers = count_outliers(r->wall, r->n);
+
+	bout_printf("Benchmark %zu: %s\n", index + 1, r->cmd);
+	bout_printf("  Time (mean +/- sd):   %8.3f %-2s +/- %7.3f %-2s"
+		    "  [User: %.3f %s, System: %.3f %s]\n",
+		    r->mean * u.scale, u.name, r->stddev * u.scale, u.name,
+		    r->user * u.scale, u.name, r->sys * u.scale, u.name);
+	bout_printf("  Range (min ... max):  %8.3f %-2s ... %7.3f %-2s"
+		    "  %zu runs\n",
+		    r->wall[0] * u.scale, u.name, r->wall[r->n - 1] * u.scale,
+		    u.name, r->n);
+	bout_puts("  Percentiles:         ");
+	for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+		bout_printf(" p%.0f %.3f %s", pcts[i] * 100,
+			    percentile(r->wall, r->n, pcts[i]) * u.scale,
+			    u.name);
+	bout_puts("\n");
+
+	if (outliers)
+		bout_printf("  Warning: %zu statistical outlier%s detected.\n",
+			    outliers, outliers == 1 ? " was" : "s were");
+	if (r->failures)
+		bout_printf("  Warning: %u run%s exited with a non-zero status.\n",
+			    r->failures, r->failures == 1 ? "" : "s");
+	bout_puts("\n");
+}
+
+/**
+ * print_comparison() - compare each result with the fastest
+ *
+ * The uncertainty of each ratio is propagated from both standard
+ * deviations.
+ */
+static void print_comparison(struct bench_result *results, size_t n)
+{
+	struct bench_result *fastest = &results[0];
+	struct bench_result *r;
+	double ratio, error;
+
+	for (size_t i = 1; i < n; i++) {
+		if (results[i].mean < fastest->mean)
+			fastest = &results[i];
+	}
+
+	bout_printf("Summary\n  %s ran\n", fastest->cmd);
+	for (size_t i = 0; i < n; i++) {
+		r = &results[i];
+		if (r == fastest)
+			continue;
+		ratio = r->mean / fastest->mean;
+		error = ratio * sqrt(pow(r->stddev / r->mean, 2) +
+				     pow(fastest->stddev / fastest->mean, 2));
+		bout_printf("    %.2f +/- %.2f times faster than %s\n", ratio,
+			    error, r->cmd);
+	}
+}
+
+static void bench_one(const char *cmd, const struct bench_options *opts,
+		      struct bench_result *r)
+{
+	double wall, user, sys;
+	double sum = 0, sq = 0;
+
+	for (unsigned int i = 0; i < opts->warmup; i++)
+		run_once(cmd, &wall, &user, &sys);
+
+	r->cmd = cmd;
+	r->n = opts->runs;
+	r->wall = malloc(r->n * sizeof(*r->wall));
+	for (size_t i = 0; i < r->n; i++) {
+		if (run_once(cmd, &r->wall[i], &user, &sys))
+			r->failures++;
+		r->user += user;
+		r->sys += sys;
+		sum += r->wall[i];
+	}
+
+	r->mean = sum / r->n;
+	r->user /= r->n;
+	r->sys /= r->n;
+	for (size_t i = 0; i < r->n; i++)
+		sq += (r->wall[i] - r->mean) * (r->wall[i] - r->mean);
+	r->stddev = r->n > 1 ? sqrt(sq / (r->n - 1)) : 0;
+}
+
+int bench_run(const char *const cmds[], size_t n_cmds,
+	      const struct bench_options *opts)
+{
+	struct bench_result *results = calloc(n_cmds, sizeof(*results));
+	int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+	int out_fd = bout_fd();
+	int saved_in, saved_out = -1;
+	int rv = 0;
+
+	/* The runs use the shell's own stdio, so point it elsewhere. */
+	bout_flush();
+	fflush(stdout);
+	saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+	dup2(null_fd, STDIN_FILENO);
+	if (!opts->show_output || out_fd != STDOUT_FILENO) {
+		saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+		dup2(opts->show_output ? out_fd : null_fd, STDOUT_FILENO);
+	}
+
+	for (size_t i = 0; i < n_cmds; i++)
+		bench_one(cmds[i], opts, &results[i]);
+
+	fflush(stdout);
+	dup2(saved_in, STDIN_FILENO);
+	close(saved_in);
+	if (saved_out >= 0) {
+		dup2(saved_out, STDOUT_FILENO);
+		close(saved_out);
+	}
+	close(null_fd);
+
+	/* Builtins run by the command lines reset the output fd. */
+	bout_set_fd(out_fd);
+	for (size_t i = 0; i < n_cmds; i++) {
+		print_result(i, &results[i]);
+		if (results[i].failures)
+			rv = 1;
+	}
+	if (n_cmds > 1)
+		print_comparison(results, n_cmds);
+
+	for (size_t i = 0; i < n_cmds; i++)
+		free(results[i].wall);
+	free(results);
+	return rv;
+}
@@ -1,3 +1,9 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,171 +11,762 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
-#include <errno.h>
-#include <fcntl.h>
 
 #include "dispatcher.h"
+#include "jobs.h"
+#include "output.h"
+#include "pathcache.h"
 #include "shell_builtins.h"
 #include "parser.h"
+#include "probes.h"
+#include "script.h"
+#include "stats.h"
+#include "trace.h"
+#include "variables.h"
+
+/* A stage of a running pipeline. */
+struct stage {
+	/* The child running this stage, or 0 if it is not a process. */
+	pid_t pid;
+
+	/* Set when the stage is a builtin running on a thread. */
+	bool threaded;
+	pthread_t thread;
+
+	/* The builtin, and the arguments for its thread. */
+	const struct command *cmd;
+	const struct builtin_command *builtin;
+	const char *const *argv;
+	/* Set when the command has redirections which setup_io() left. */
+	bool redirected;
+	/* Set when stdin is a pipe or redirection, not the shell's own. */
+	bool input_redirected;
+	int in_fd;
+	int out_fd;
+	int err_fd;
+	int last_rv;
+
+	/*
+	 * The environment for the stage.  own_envp is set when it was
+	 * allocated for the stage's prefix assignments.
+	 */
+	char *const *envp;
+	char **own_envp;
+
+	/* The return status, once a builtin has finished. */
+	int rv;
+};
+
+/* The lowest fd used to save the shell's fds during a redirection. */
+#define SAVED_FD_MIN 10
+
+/**
+ * close_fd() - close a stage's fd, unless it's the shell's own stdio
+ */
+static void close_fd(int fd)
+{
+	if (fd > STDERR_FILENO)
+		close(fd);
+}
+
+/**
+ * next_stage() - get the command after @cmd in its pipeline, or NULL
+ */
+static struct command *next_stage(struct command *cmd)
+{
+	return cmd->output_type == COMMAND_OUTPUT_PIPE ? cmd->pipe_to : NULL;
+}
 
-int setup_io(struct command *current_cmd, int *input_fd, int *output_fd, int *curr_pipe);
+/**
+ * stdio_redirections_only() - check whether a command's redirections
+ * are all files opened onto stdin or stdout
+ *
+ * Their order only decides which file wins, so setup_io() can open
+ * them as the stage's own input and output, and a builtin with them
+ * can still run without touching the shell's fds.
+ */
+static bool stdio_redirections_only(const struct command *cmd)
+{
+	for (size_t i = 0; i < cmd->n_redirections; i++) {
+		const struct redirection *r = &cmd->redirections[i];
 
-void execute_child_process(struct command *current_cmd, int input_fd, int output_fd, int *curr_pipe);
+		switch (r->type) {
+		case REDIRECTION_INPUT:
+			if (r->fd != STDIN_FILENO)
+				return false;
+			break;
+		case REDIRECTION_TRUNCATE:
+		case REDIRECTION_APPEND:
+			if (r->fd != STDOUT_FILENO)
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
 
-void handle_parent_process(struct command *current_cmd, int *input_fd, int *prev_pipe, int *curr_pipe);
+/**
+ * redirects_fd() - check whether a command has a redirection of @fd
+ */
+static bool redirects_fd(const struct command *cmd, int fd)
+{
+	for (size_t i = 0; i < cmd->n_redirections; i++) {
+		if (cmd->redirections[i].fd == fd)
+			return true;
+	}
+	return false;
+}
 
-int setup_io(struct command *current_cmd, int *input_fd, int *output_fd, int *curr_pipe) {
-	if (current_cmd->output_type == COMMAND_OUTPUT_PIPE) {
-		if (pipe(curr_pipe) == -1) {
+/**
+ * setup_io() - open the input and output of a pipeline stage
+ *
+ * Every fd opened here is close-on-exec, so children only inherit
+ * the fds which are moved onto their stdin and stdout.
+ *
+ * @cmd:          The stage.
+ * @in_fd:        On entry, the read end of the pipe from the previous
+ *                stage, or STDIN_FILENO.  Replaced by the input file
+ *                when the stage has one.
+ * @out_fd:       Output parameter for the fd the stage writes to.
+ * @next_in_fd:   Output parameter for the read end of the pipe to the
+ *                next stage, or STDIN_FILENO.
+ *
+ * Redirections are only opened here when stdio_redirections_only()
+ * allows it.  Otherwise, they are applied to the stage's fds by
+ * apply_redirections(), after the pipes.
+ *
+ * Return: zero on success, or -1 on failure, in which case the only
+ * fd left for the caller to close is @in_fd.
+ */
+static int setup_io(struct command *cmd, int *in_fd, int *out_fd,
+		    int *next_in_fd)
+{
+	int pipe_fds[2];
+	int flags, fd;
+
+	*out_fd = STDOUT_FILENO;
+	*next_in_fd = STDIN_FILENO;
+
+	if (cmd->output_type == COMMAND_OUTPUT_PIPE) {
+		if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
 			perror("pipe failed");
 			return -1;
 		}
-		*output_fd = curr_pipe[1];
-	} else if (current_cmd->output_type == COMMAND_OUTPUT_FILE_TRUNCATE) {
-		*output_fd = open(current_cmd->output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	} else if (current_cmd->output_type == COMMAND_OUTPUT_FILE_APPEND) {
-		*output_fd = open(current_cmd->output_filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
-	}
-		
-	// Check for input redirection < 
-	if (current_cmd->input_filename) {
-		*input_fd = open(current_cmd->input_filename, O_RDONLY);
-		if (*input_fd == -1) {
-			perror("Failed to open input file for reading");
+		*out_fd = pipe_fds[1];
+		*next_in_fd = pipe_fds[0];
+	}
+
+	if (!stdio_redirections_only(cmd))
+		return 0;
+
+	for (size_t i = 0; i < cmd->n_redirections; i++) {
+		const struct redirection *r = &cmd->redirections[i];
+
+		flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+		if (r->type == REDIRECTION_INPUT)
+			flags = O_RDONLY | O_CLOEXEC;
+		else if (r->type == REDIRECTION_APPEND)
+			flags |= O_APPEND;
+		else
+			flags |= O_TRUNC;
+		fd = open(r->filename, flags, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", r->filename,
+				strerror(errno));
+			close_fd(*out_fd);
+			close_fd(*next_in_fd);
+			*out_fd = STDOUT_FILENO;
+			*next_in_fd = STDIN_FILENO;
 			return -1;
 		}
+		if (r->fd == STDIN_FILENO) {
+			close_fd(*in_fd);
+			*in_fd = fd;
+		} else {
+			close_fd(*out_fd);
+			*out_fd = fd;
+		}
 	}
+	return 0;
+}
 
-	if ((*output_fd == -1) && (current_cmd->output_type == COMMAND_OUTPUT_FILE_TRUNCATE || current_cmd->output_type == COMMAND_OUTPUT_FILE_APPEND)) {
-		perror("Failed to open output file");
-		return -1;
+/**
+ * redirect_stdio() - move a stage's fds onto stdin, stdout and stderr
+ *
+ * This is only called in a forked child.
+ */
+static void redirect_stdio(int in_fd, int out_fd, int err_fd)
+{
+	if (in_fd != STDIN_FILENO)
+		dup2(in_fd, STDIN_FILENO);
+	if (out_fd != STDOUT_FILENO)
+		dup2(out_fd, STDOUT_FILENO);
+	if (err_fd != STDERR_FILENO)
+		dup2(err_fd, STDERR_FILENO);
+
+	close_fd(in_fd);
+	if (out_fd != in_fd)
+		close_fd(out_fd);
+	if (err_fd != in_fd && err_fd != out_fd)
+		close_fd(err_fd);
+}
+
+/**
+ * apply_redirections() - perform a command's redirections on this process
+ *
+ * @saved:      When not NULL, filled in with a close-on-exec copy of
+ *              each fd before it is replaced, or -1 if it was not
+ *              open, for restore_redirections().
+ * @n_applied:  When @saved is not NULL, set to the number of entries
+ *              of @saved which were filled in, even on failure.
+ *
+ * Files are opened without close-on-exec, so that fds such as the 3
+ * in "exec 3<file" are inherited by commands.
+ *
+ * Return: zero on success, or -1 on failure.
+ */
+static int apply_redirections(const struct command *cmd, int *saved,
+			      size_t *n_applied)
+{
+	for (size_t i = 0; i < cmd->n_redirections; i++) {
+		const struct redirection *r = &cmd->redirections[i];
+		int flags = O_WRONLY | O_CREAT;
+		int fd;
+
+		if (saved) {
+			/* Don't lose an earlier saved fd by replacing it. */
+			for (size_t j = 0; j < i; j++) {
+				if (saved[j] == r->fd) {
+					saved[j] = fcntl(r->fd, F_DUPFD_CLOEXEC,
+							 SAVED_FD_MIN);
+					close(r->fd);
+				}
+			}
+			saved[i] = fcntl(r->fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+			*n_applied = i + 1;
+		}
+
+		switch (r->type) {
+		case REDIRECTION_CLOSE:
+			close(r->fd);
+			continue;
+		case REDIRECTION_DUP:
+			if (dup2(r->source_fd, r->fd) < 0) {
+				fprintf(stderr, "%d: %s\n", r->source_fd,
+					strerror(errno));
+				return -1;
+			}
+			continue;
+		case REDIRECTION_INPUT:
+			flags = O_RDONLY;
+			break;
+		case REDIRECTION_TRUNCATE:
+			flags |= O_TRUNC;
+			break;
+		case REDIRECTION_APPEND:
+			flags |= O_APPEND;
+			break;
+		}
+
+		fd = open(r->filename, flags, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", r->filename,
+				strerror(errno));
+			return -1;
+		}
+		if (fd != r->fd) {
+			dup2(fd, r->fd);
+			close(fd);
+		}
 	}
+	return 0;
+}
 
-	// success
-	return 0; 
+/**
+ * restore_redirections() - undo apply_redirections()
+ */
+static void restore_redirections(const struct command *cmd, int *saved,
+				 size_t n_applied)
+{
+	for (size_t i = n_applied; i-- > 0;) {
+		int fd = cmd->redirections[i].fd;
+
+		if (saved[i] < 0) {
+			close(fd);
+			continue;
+		}
+		dup2(saved[i], fd);
+		close(saved[i]);
+	}
 }
 
-void execute_child_process(struct command *current_cmd, int input_fd, int output_fd, int *curr_pipe) {
-	// redirect stdin and/or output if necessary
-	if (input_fd != STDIN_FILENO) {
-		dup2(input_fd, STDIN_FILENO);
-		close(input_fd);
+/**
+ * run_builtin() - run a builtin with its stdio bound to the given fds
+ *
+ * The builtin reads from builtin_input_fd and writes through the
+ * buffered output layer, both of which are thread-local, so the
+ * shell's own stdin and stdout are left untouched.
+ *
+ * Return: the return status of the builtin.
+ */
+static int run_builtin(const struct stage *stage, bool *shell_should_exit,
+		       int in_fd, int out_fd)
+{
+	const char *const *argv = stage->argv;
+	uint64_t start = stats_now_ns();
+	int rv;
+
+	builtin_input_fd = in_fd;
+	builtin_input_redirected = stage->input_redirected;
+	builtin_envp = stage->envp;
+	bout_set_fd(out_fd);
+
+	rv = stage->builtin->handler(argv, stage->last_rv, shell_should_exit);
+	if (bout_flush() < 0) {
+		/* A reader going away early is not worth reporting. */
+		if (errno != EPIPE)
+			fprintf(stderr, "%s: write error: %s\n", argv[0],
+				strerror(errno));
+		rv = rv ? rv : 1;
 	}
-	if (output_fd != STDOUT_FILENO) {
-		dup2(output_fd, STDOUT_FILENO);
-		close(output_fd);
+
+	bout_set_fd(STDOUT_FILENO);
+	builtin_envp = NULL;
+	builtin_input_redirected = false;
+	builtin_input_fd = STDIN_FILENO;
+	trace_span("builtin", start, argv[0], "status", rv);
+	return rv;
+}
+
+/**
+ * run_builtin_redirected() - run a builtin in the shell, on its own fds
+ *
+ * The stage's input and output are moved onto the shell's stdin and
+ * stdout, so redirections such as "2>&1" refer to them, and the
+ * redirections are applied to the shell's fds.  Everything is put
+ * back afterwards, unless the builtin makes them persistent.
+ *
+ * Return: the return status of the builtin, or 1 if a redirection
+ * failed.
+ */
+static int run_builtin_redirected(const struct stage *stage,
+				  bool *shell_should_exit, int in_fd,
+				  int out_fd)
+{
+	const struct command *cmd = stage->cmd;
+	bool persistent =
+		(stage->builtin->flags & BUILTIN_PERSISTENT_REDIRECTIONS) &&
+		!cmd->argv[1];
+	int saved_in = -1, saved_out = -1;
+	int *saved = NULL;
+	size_t n_applied = 0;
+	int rv = 1;
+
+	/* Anything the shell has buffered belongs to the old stdout. */
+	fflush(stdout);
+
+	if (!persistent) {
+		saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+		saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+		saved = malloc(cmd->n_redirections * sizeof(*saved));
 	}
+	if (in_fd != STDIN_FILENO)
+		dup2(in_fd, STDIN_FILENO);
+	if (out_fd != STDOUT_FILENO)
+		dup2(out_fd, STDOUT_FILENO);
+
+	if (!stage->redirected || !apply_redirections(cmd, saved, &n_applied))
+		rv = run_builtin(stage, shell_should_exit, STDIN_FILENO,
+				 STDOUT_FILENO);
 
-	// Close unused write end of the current pipe
-	if (current_cmd->output_type == COMMAND_OUTPUT_PIPE) {
-		close(curr_pipe[1]); 
+	if (persistent)
+		return rv;
+
+	restore_redirections(cmd, saved, n_applied);
+	free(saved);
+	if (saved_in >= 0) {
+		dup2(saved_in, STDIN_FILENO);
+		close(saved_in);
+	}
+	if (saved_out >= 0) {
+		dup2(saved_out, STDOUT_FILENO);
+		close(saved_out);
 	}
+	return rv;
+}
+
+static void *builtin_thread(void *arg)
+{
+	struct stage *stage = arg;
+	bool shell_should_exit = false;
+	sigset_t sigpipe;
+
+	/* Writing to a closed pipe should fail, not kill the shell. */
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+	stage->rv = run_builtin(stage, &shell_should_exit, stage->in_fd,
+				stage->out_fd);
+	close_fd(stage->in_fd);
+	close_fd(stage->out_fd);
+	stats_thread_exit();
+	return NULL;
+}
+
+void exec_path(const char *path, const char *const argv[],
+	       char *const envp[])
+{
+	size_t argc = 0;
+	const char **sh_argv;
 
-	execvp(current_cmd->argv[0], current_cmd->argv);
+	execve(path, (char *const *)argv, envp);
+	if (errno != ENOEXEC)
+		return;
 
-	perror("execvp failed");
-	exit(-1);
+	/* No "#!" line.  Run it with sh, as execvp() would. */
+	while (argv[argc])
+		argc++;
+	sh_argv = malloc((argc + 2) * sizeof(*sh_argv));
+	sh_argv[0] = "sh";
+	sh_argv[1] = path;
+	memcpy(sh_argv + 2, argv + 1, argc * sizeof(*sh_argv));
+	execve("/bin/sh", (char *const *)sh_argv, envp);
+	free(sh_argv);
 }
 
-void handle_parent_process(struct command *current_cmd, int *input_fd, int *prev_pipe, int *curr_pipe) {
-	// close write end in parent if current command output is a pipe
-	if (current_cmd->output_type == COMMAND_OUTPUT_PIPE) {
-		close(curr_pipe[1]);
+/**
+ * exec_command() - replace a forked child with a stage's command
+ *
+ * @path:   The executable found for the command, or NULL.
+ *
+ * This does not return.
+ */
+static _Noreturn void exec_command(const struct stage *stage,
+				    const char *path)
+{
+	if (!path) {
+		PROBE2(exec_failed, stage->argv[0], ENOENT);
+		script_print_position(stderr);
+		fprintf(stderr, "%s: command not found\n", stage->argv[0]);
+		_exit(-1);
+	}
+
+	exec_path(path, stage->argv, stage->envp);
+	PROBE2(exec_failed, stage->argv[0], errno);
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	_exit(-1);
+}
+
+/**
+ * fork_stage() - run a stage in a child process
+ *
+ * External commands are exec'd, after finding them through the path
+ * cache in the parent, so the lookup is remembered for next time.
+ * Builtins are run directly in the child, so any changes they make to
+ * the shell state are discarded.
+ *
+ * Return: zero on success, or -1 on failure.
+ */
+static int fork_stage(struct stage *stage)
+{
+	bool shell_should_exit = false;
+	char *path = NULL;
+	uint64_t start;
+	int rv;
+
+	if (!stage->builtin) {
+		start = stats_now_ns();
+		path = path_lookup(stage->argv[0]);
+		trace_span("path_lookup", start, stage->argv[0], NULL, 0);
 	}
 
-	// Close read end of previous pipe
-	if (prev_pipe[0] != -1) {
-		close(prev_pipe[0]);
+	start = stats_now_ns();
+	PROBE1(spawn_start, stage->argv[0]);
+	stage->pid = fork();
+	if (stage->pid != 0)
+		PROBE2(spawn_end, stage->argv[0], stage->pid);
+	if (stage->pid > 0) {
+		stats_hist_add(stats_self()->spawn_hist,
+			       stats_now_ns() - start);
+		trace_span("fork", start, stage->argv[0], "pid", stage->pid);
+		STATS_INC(forks);
+		if (!stage->builtin)
+			STATS_INC(execs);
 	}
+	if (stage->pid != 0)
+		free(path);
+	if (stage->pid < 0) {
+		perror("fork failed");
+		stage->pid = 0;
+		return -1;
+	}
+	if (stage->pid > 0)
+		return 0;
 
-	// Set the input FD to the read end of curr pipe
-	*input_fd = (current_cmd->output_type == COMMAND_OUTPUT_PIPE) ? curr_pipe[0] : STDIN_FILENO;
+	start = stats_now_ns();
+	redirect_stdio(stage->in_fd, stage->out_fd, stage->err_fd);
+	if (stage->redirected &&
+	    apply_redirections(stage->cmd, NULL, NULL) < 0)
+		_exit(1);
+	trace_span("child_setup", start, stage->argv[0], NULL, 0);
+	if (stage->builtin) {
+		rv = run_builtin(stage, &shell_should_exit, STDIN_FILENO,
+				 STDOUT_FILENO);
+		_exit(rv);
+	}
 
-	// Copy current pipe to prev pipe for next iteration
-	prev_pipe[0] = curr_pipe[0];
-	prev_pipe[1] = curr_pipe[1];
+	exec_command(stage, path);
 }
 
 /**
- * dispatch_external_command() - run a pipeline of commands
+ * start_stage() - start running a stage of a pipeline
  *
- * @pipeline:   A "struct command" pointer representing one or more
- *              commands chained together in a pipeline.  See the
- *              documentation in parser.h for the layout of this data
- *              structure.  It is also recommended that you use the
- *              "parseview" demo program included in this project to
- *              observe the layout of this structure for a variety of
- *              inputs.
+ * A builtin which is the only stage runs directly in the shell, so it
+ * can change the shell's state.  In a longer pipeline, builtins which
+ * would change the shell's state are run in a forked child, as in
+ * other shells, and the rest run in-process on a thread, unless they
+ * have redirections of their own.  External commands are always
+ * forked, as is every stage of a pipeline run in the background.
  *
- * Note: this function should not return until all commands in the
- * pipeline have completed their execution.
+ * The stage takes ownership of @in_fd and @out_fd.
  *
- * Return: The return status of the last command executed in the
- * pipeline.
+ * Return: zero on success, or -1 on failure.
  */
-static int dispatch_external_command(struct command *pipeline)
+static int start_stage(struct stage *stage, struct command *cmd,
+		       int in_fd, int out_fd, int last_rv, bool only_stage,
+		       bool background, bool *shell_should_exit)
 {
-	/*
-	 * Note: this is where you'll start implementing the project.
-	 *
-	 * It's the only function with a "TODO".  However, if you try
-	 * and squeeze your entire external command logic into a
-	 * single routine with no helper functions, you'll quickly
-	 * find your code becomes sloppy and unmaintainable.
-	 *
-	 * It's up to *you* to structure your software cleanly.  Write
-	 * plenty of helper functions, and even start making yourself
-	 * new files if you need.
-	 *
-	 * For D1: you only need to support running a single command
-	 * (not a chain of commands in a pipeline), with no input or
-	 * output files (output to stdout only).  In other words, you
-	 * may live with the assumption that the "input_file" field in
-	 * the pipeline struct you are given is NULL, and that
-	 * "output_type" will always be COMMAND_OUTPUT_STDOUT.
-	 *
-	 * For D2: you'll extend this function to support input and
-	 * output files, as well as pipeline functionality.
-	 *
-	 * Good luck!
-	 */
+	uint64_t start;
+	int rv = 0;
 
-	pid_t pid;
-	int status;
+	stage->cmd = cmd;
+	start = stats_now_ns();
+	stage->builtin = find_builtin(cmd->argv[0]);
+	trace_span("builtin_lookup", start, cmd->argv[0], "found",
+		   !!stage->builtin);
+	stage->argv = (const char *const *)cmd->argv;
+	stage->redirected = !stdio_redirections_only(cmd);
+	stage->input_redirected = in_fd != STDIN_FILENO ||
+				  redirects_fd(cmd, STDIN_FILENO);
+	stage->in_fd = in_fd;
+	stage->out_fd = out_fd;
+	stage->err_fd = STDERR_FILENO;
+	stage->last_rv = last_rv;
 
-	// File descriptors for input/output redir. 
-	int input_fd = STDIN_FILENO;
-	int output_fd = STDOUT_FILENO;
+	/* The assignments before a command only apply to its environment. */
+	if (cmd->assignments[0]) {
+		stage->own_envp = var_envp_with(cmd->assignments);
+		stage->envp = stage->own_envp;
+	} else {
+		stage->envp = var_envp();
+	}
+	if (stage->builtin)
+		STATS_INC(builtin_runs);
 
-	int prev_pipe[2] = {-1, -1};
-	int curr_pipe[2];
+	if (background) {
+		rv = fork_stage(stage);
+	} else if (stage->builtin && only_stage &&
+		   (stage->redirected ||
+		    stage->builtin->flags & BUILTIN_PERSISTENT_REDIRECTIONS)) {
+		stage->rv = run_builtin_redirected(stage, shell_should_exit,
+						   in_fd, out_fd);
+	} else if (stage->builtin && only_stage) {
+		stage->rv = run_builtin(stage, shell_should_exit, in_fd, out_fd);
+	} else if (stage->builtin && !stage->redirected &&
+		   !(stage->builtin->flags & BUILTIN_STATEFUL) &&
+		   !pthread_create(&stage->thread, NULL, builtin_thread,
+				   stage)) {
+		/* The thread now owns the fds. */
+		stage->threaded = true;
+		STATS_INC(builtin_threads);
+		return 0;
+	} else {
+		rv = fork_stage(stage);
+	}
 
-	struct command *current_cmd = pipeline;
+	close_fd(in_fd);
+	close_fd(out_fd);
+	return rv;
+}
 
-	while (current_cmd) {
-		if (setup_io(current_cmd, &input_fd, &output_fd, curr_pipe) == -1) {
-			return -1;
+/**
+ * wait_stage() - wait for a stage to finish
+ *
+ * Return: the return status of the stage.
+ */
+static int wait_stage(struct stage *stage)
+{
+	uint64_t start = stats_now_ns();
+	int rv = stage->rv;
+	int status;
+
+	if (stage->threaded) {
+		pthread_join(stage->thread, NULL);
+		rv = stage->rv;
+	} else if (stage->pid) {
+		while (waitpid(stage->pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				perror("waitpid failed");
+				status = -1;
+				break;
+			}
 		}
+		if (status >= 0)
+			PROBE2(child_reap, stage->pid, status);
+		rv = status >= 0 && WIFEXITED(status) ? WEXITSTATUS(status) :
+							   -1;
+	}
 
-		pid = fork();
+	stats_add(&stats_self()->wait_ns, stats_now_ns() - start);
+	if (stage->threaded || stage->pid)
+		trace_span(stage->threaded ? "join" : "waitpid", start,
+			   stage->argv ? stage->argv[0] : NULL, "status", rv);
+	return rv;
+}
 
-		if (pid == 0) {
-			// Child process
-			execute_child_process(current_cmd, input_fd, output_fd, curr_pipe);
-		} else if (pid > 0) {
-			// Parent process
-			handle_parent_process(current_cmd, &input_fd, prev_pipe, curr_pipe);
-			current_cmd = current_cmd->pipe_to; // move to next command
-		} else {
-			perror("fork failed");
-			return -1;
+/**
+ * spawn() - start a command in a child process, as a pipeline stage
+ *
+ * @builtin:    The builtin to run in the child, or NULL to exec the
+ *              command.
+ *
+ * Return: the pid of the child, or -1 if it could not be forked.
+ */
+static pid_t spawn(const struct builtin_command *builtin,
+		   const char *const argv[], char *const envp[], int in_fd,
+		   int out_fd, int err_fd)
+{
+	struct stage stage = {
+		.builtin = builtin,
+		.argv = argv,
+		.input_redirected = in_fd != STDIN_FILENO,
+		.in_fd = in_fd,
+		.out_fd = out_fd,
+		.err_fd = err_fd,
+		.envp = envp,
+	};
+
+	if (fork_stage(&stage) < 0)
+		return -1;
+	return stage.pid;
+}
+
+pid_t spawn_command(const char *const argv[], char *const envp[], int in_fd,
+		    int out_fd, int err_fd)
+{
+	return spawn(find_builtin(argv[0]), argv, envp, in_fd, out_fd,
+		     err_fd);
+}
+
+pid_t spawn_external(const char *const argv[], char *const envp[], int in_fd,
+		     int out_fd, int err_fd)
+{
+	return spawn(NULL, argv, envp, in_fd, out_fd, err_fd);
+}
+
+int wait_command(pid_t pid)
+{
+	struct stage stage = { .pid = pid };
+
+	return wait_stage(&stage);
+}
+
+/**
+ * add_job() - record the stages of a pipeline run in the background
+ */
+static void add_job(const struct stage *stages, size_t n_stages,
+		    const char *input)
+{
+	pid_t *pids = malloc(n_stages * sizeof(*pids));
+	int id;
+
+	for (size_t i = 0; i < n_stages; i++)
+		pids[i] = stages[i].pid;
+	id = jobs_add(pids, n_stages, input);
+	if (isatty(STDIN_FILENO))
+		fprintf(stderr, "[%d] %d\n", id, pids[n_stages - 1]);
+	free(pids);
+}
+
+/**
+ * run_pipeline() - run a pipeline of commands
+ *
+ * @pipeline:           A "struct command" pointer representing one or
+ *                      more commands chained together in a pipeline.
+ *                      See the documentation in parser.h for the
+ *                      layout of this data structure.
+ * @last_rv:            The return code of the previously executed
+ *                      command.
+ * @shell_should_exit:  Output parameter which is set to true when the
+ *                      shell is intended to exit.
+ *
+ * @input:              The command line, to show for a job.
+ *
+ * Every stage is started before any is waited for, and this does not
+ * return until all of them have completed, unless the pipeline is run
+ * in the background.  Then, its processes are added to the job table
+ * instead, and it reads from /dev/null unless it is redirected.
+ *
+ * Return: The return status of the last command in the pipeline, zero
+ * for a pipeline run in the background, or 1 if the pipeline could
+ * not be started.
+ */
+static int run_pipeline(struct command *pipeline, int last_rv,
+			bool *shell_should_exit, const char *input)
+{
+	struct stage *stages;
+	struct command *cmd;
+	size_t n_stages = 0;
+	size_t started = 0;
+	int in_fd = STDIN_FILENO;
+	int out_fd, next_in_fd;
+	bool failed = false;
+	int rv = 0;
+
+	for (cmd = pipeline; cmd; cmd = next_stage(cmd))
+		n_stages++;
+	stages = calloc(n_stages, sizeof(*stages));
+
+	if (pipeline->background) {
+		in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (in_fd < 0) {
+			perror("/dev/null");
+			in_fd = STDIN_FILENO;
+		}
+	}
+
+	for (cmd = pipeline; cmd; cmd = next_stage(cmd)) {
+		if (setup_io(cmd, &in_fd, &out_fd, &next_in_fd) < 0) {
+			failed = true;
+			break;
 		}
+		if (start_stage(&stages[started], cmd, in_fd, out_fd, last_rv,
+				n_stages == 1, pipeline->background,
+				shell_should_exit) < 0) {
+			close_fd(next_in_fd);
+			in_fd = STDIN_FILENO;
+			failed = true;
+			break;
+		}
+		started++;
+		in_fd = next_in_fd;
 	}
+	close_fd(in_fd);
 
-	// Wait for all child processes to complete
-	while(wait(&status) > 0);
+	if (pipeline->background && started) {
+		add_job(stages, started, input);
+	} else {
+		for (size_t i = 0; i < started; i++)
+			rv = wait_stage(&stages[i]);
+	}
 
-	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	for (size_t i = 0; i < n_stages; i++)
+		free(stages[i].own_envp);
+	free(stages);
+	return failed ? 1 : rv;
 }
 
 /**
@@ -180,34 +777,26 @@ static int dispatch_external_command(struct command *pipeline)
  *                      command.
  * @shell_should_exit:  Output parameter which is set to true when the
  *                      shell is intended to exit.
+ * @input:              The command line it was parsed from.
  *
  * Return: the return status of the command.
  */
 static int dispatch_parsed_command(struct command *cmd, int last_rv,
-				   bool *shell_should_exit)
-{
-	/* First, try to see if it's a builtin. */
-	for (size_t i = 0; builtin_commands[i].name; i++) {
-		if (!strcmp(builtin_commands[i].name, cmd->argv[0])) {
-			/* We found a match!  Run it. */
-			return builtin_commands[i].handler(
-				(const char *const *)cmd->argv, last_rv,
-				shell_should_exit);
-		}
-	}
-
-	/* Otherwise, it's an external command. */
-	return dispatch_external_command(cmd);
+				   bool *shell_should_exit, const char *input)
+{
+	return run_pipeline(cmd, last_rv, shell_should_exit, input);
 }
 
 int shell_command_dispatcher(const char *input, int last_rv,
 			     bool *shell_should_exit)
 {
 	int rv;
+	uint64_t start = stats_now_ns();
 	struct command *parse_result;
 	enum parse_error parse_error = parse_input(input, &parse_result);
 
 	if (parse_error) {
+		script_print_position(stderr);
 		fprintf(stderr, "Input parse error: %s\n",
 			parse_error_str[parse_error]);
 		return -1;
@@ -217,7 +806,12 @@ int shell_command_dispatcher(const char *input, int last_rv,
 	if (!parse_result)
 		return last_rv;
 
-	rv = dispatch_parsed_command(parse_result, last_rv, shell_should_exit);
+	STATS_INC(commands);
+	/* Reap any background jobs which have finished meanwhile. */
+	jobs_update(false);
+	rv = dispatch_parsed_command(parse_result, last_rv, shell_should_exit,
+				     input);
 	free_parse_result(parse_result);
+	trace_span("command", start, input, "status", rv);
 	return rv;
 }
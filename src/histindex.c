@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "histindex.h"
+
+struct hist_node {
+	/*
+	 * The edge label leading to this node.  It points into a line
+	 * owned by some node, as lines are never freed individually.
+	 */
+	const char *label;
+	size_t label_len;
+
+	/* The line ending at this node, or NULL. */
+	char *line;
+
+	/* The most recently added line in this subtree. */
+	const char *latest;
+
+	struct hist_node **children;
+	size_t n_children;
+};
+
+static struct hist_node root;
+
+static struct hist_node *find_child(struct hist_node *node, char c)
+{
+	for (size_t i = 0; i < node->n_children; i++) {
+		if (node->children[i]->label[0] == c)
+			return node->children[i];
+	}
+	return NULL;
+}
+
+static void add_child(struct hist_node *node, struct hist_node *child)
+{
+	node->children = realloc(node->children, (node->n_children + 1) *
+							 sizeof(*node->children));
+	node->children[node->n_children++] = child;
+}
+
+static size_t common_len(const char *a, size_t a_len, const char *b)
+{
+	size_t i = 0;
+
+	while (i < a_len && a[i] == b[i])
+		i++;
+	return i;
+}
+
+/**
+ * split_child() - split the edge to @child after @len bytes
+ *
+ * Return: the new node in the middle of the edge.
+ */
+static struct hist_node *split_child(struct hist_node *node,
+				     struct hist_node *child, size_t len)
+{
+	struct hist_node *mid = calloc(1, sizeof(*mid));
+
+	mid->label = child->label;
+	mid->label_len = len;
+	mid->latest = child->latest;
+	child->label += len;
+	child->label_len -= len;
+	add_child(mid, child);
+
+	for (size_t i = 0; i < node->n_children; i++) {
+		if (node->children[i] == child)
+			node->children[i] = mid;
+	}
+	return mid;
+}
+
+static struct hist_node *find_exact(const char *line)
+{
+	struct hist_node *node = &root;
+
+	while (*line) {
+		node = find_child(node, *line);
+		if (!node ||
+		    common_len(node->label, node->label_len, line) <
+			    node->label_len)
+			return NULL;
+		line += node->label_len;
+	}
+	return node;
+}
+
+void hist_index_add(const char *line)
+{
+	struct hist_node *node = find_exact(line);
+	struct hist_node *child;
+	const char *owned;
+	const char *rest;
+	size_t len;
+
+	owned = node && node->line ? node->line : strdup(line);
+	rest = owned;
+	node = &root;
+	for (;;) {
+		node->latest = owned;
+		if (!*rest) {
+			node->line = (char *)owned;
+			return;
+		}
+
+		child = find_child(node, *rest);
+		if (!child) {
+			child = calloc(1, sizeof(*child));
+			child->label = rest;
+			child->label_len = strlen(rest);
+			add_child(node, child);
+		}
+
+		len = common_len(child->label, child->label_len, rest);
+		if (len < child->label_len)
+			child = split_child(node, child, len);
+		rest += len;
+		node = child;
+	}
+}
+
+const char *hist_index_lookup(const char *prefix)
+{
+	struct hist_node *node = &root;
+	size_t len;
+
+	while (*prefix) {
+		node = find_child(node, *prefix);
+		if (!node)
+			return NULL;
+		len = common_len(node->label, node->label_len, prefix);
+		if (!prefix[len])
+			break;
+		if (len < node->label_len)
+			return NULL;
+		prefix += len;
+	}
+	return node->latest;
+}
+
+static void free_node(struct hist_node *node)
+{
+	for (size_t i = 0; i < node->n_children; i++) {
+		free_node(node->children[i]);
+		free(node->children[i]);
+	}
+	free(node->children);
+	free(node->line);
+}
+
+void hist_index_clear(void)
+{
+	free_node(&root);
+	memset(&root, 0, sizeof(root));
+}
@@ -3,18 +3,220 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <malloc.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
 
+#ifndef NO_READLINE
 #include <readline/readline.h>
+#endif
 #include <readline/history.h>
 
+#include "histindex.h"
+#include "jobs.h"
+#include "lineedit.h"
+#include "options.h"
 #include "parser.h"
 #include "interact.h"
+#include "stats.h"
+#include "trace.h"
+#include "workdir.h"
+
+/* The line editor in use. */
+#ifdef NO_READLINE
+static char *(*read_line)(const char *prompt) = lineedit;
+#else
+static char *(*read_line)(const char *prompt) = readline;
+#endif
+
+int interact_set_line_editor(const char *name)
+{
+	if (!strcmp(name, "builtin")) {
+		read_line = lineedit;
+		return 0;
+	}
+#ifndef NO_READLINE
+	if (!strcmp(name, "readline")) {
+		read_line = readline;
+		return 0;
+	}
+#endif
+	fprintf(stderr, "Unknown line editor: %s\n", name);
+	return -1;
+}
+
+/* The session recording, or NULL when not recording. */
+static FILE *record_file;
+
+int interact_record(const char *path)
+{
+	FILE *f = fopen(path, "ae");
+
+	if (!f) {
+		fprintf(stderr, "Unable to open recording %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+	setvbuf(f, NULL, _IOLBF, 0);
+	if (record_file)
+		fclose(record_file);
+	record_file = f;
+	return 0;
+}
+
+static long long timespec_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/**
+ * record_field() - write a recording field, then @sep
+ *
+ * Backslashes, tabs and newlines are escaped as \\, \t and \n, so that
+ * a field cannot be mistaken for the end of one or of the record.
+ */
+static void record_field(const char *field, char sep)
+{
+	for (; *field; field++) {
+		if (*field == '\\')
+			fputs("\\\\", record_file);
+		else if (*field == '\t')
+			fputs("\\t", record_file);
+		else if (*field == '\n')
+			fputs("\\n", record_file);
+		else
+			putc(*field, record_file);
+	}
+	putc(sep, record_file);
+}
+
+/**
+ * record_dispatch() - run the dispatcher, recording it if enabled
+ *
+ * Each dispatched line is appended to the recording as:
+ *    START_NS <tab> DURATION_NS <tab> RV <tab> CWD <tab> LINE
+ * where START_NS is the wall-clock time the line was dispatched at.
+ * CWD and LINE are escaped by record_field().
+ *
+ * Return: the return value of the dispatcher.
+ */
+static int record_dispatch(const char *line, int last_rv,
+			   int (*dispatcher)(const char *line, int last_rv,
+					     bool *shell_should_exit),
+			   bool *shell_should_exit)
+{
+	struct timespec wall, start, end;
+	const char *cwd = workdir_get();
+	int rv;
+
+	if (!record_file)
+		return dispatcher(line, last_rv, shell_should_exit);
+
+	clock_gettime(CLOCK_REALTIME, &wall);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rv = dispatcher(line, last_rv, shell_should_exit);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(record_file, "%lld\t%lld\t%d\t", timespec_ns(&wall),
+		timespec_ns(&end) - timespec_ns(&start), rv);
+	record_field(cwd ? cwd : "???", '\t');
+	record_field(line, '\n');
+	return rv;
+}
+
+/*
+ * Heap accounting for the interact loop, in test builds.  Once the
+ * loop has warmed up, the heap must not keep growing from one input to
+ * the next, except for the history, which is meant to grow and is left
+ * out.  A leak of even a few bytes per input, or memory which is kept
+ * referenced but never reused, is caught by util/leak-check, which
+ * feeds the loop a million inputs.
+ */
+#ifdef TEST_BUILD
+#define HEAP_WARMUP_INPUTS 1000
+#define HEAP_GROWTH_MAX (1L << 20)
+
+/* The bytes taken by the history since the shell started. */
+static long history_heap_bytes;
+
+#ifdef __SANITIZE_ADDRESS__
+/*
+ * ASan's own count of live bytes takes time growing with the number of
+ * threads there have ever been, so it is counted here instead, from
+ * when the loop starts.  Only differences in it are used.
+ */
+int __sanitizer_install_malloc_and_free_hooks(
+	void (*malloc_hook)(const volatile void *ptr, size_t size),
+	void (*free_hook)(const volatile void *ptr));
+size_t __sanitizer_get_allocated_size(const volatile void *ptr);
+
+static long heap_bytes;
+
+static void count_malloc(const volatile void *ptr, size_t size)
+{
+	__atomic_fetch_add(&heap_bytes, size, __ATOMIC_RELAXED);
+}
+
+static void count_free(const volatile void *ptr)
+{
+	__atomic_fetch_sub(&heap_bytes, __sanitizer_get_allocated_size(ptr),
+			   __ATOMIC_RELAXED);
+}
+
+static void start_heap_count(void)
+{
+	__sanitizer_install_malloc_and_free_hooks(count_malloc, count_free);
+}
+
+static long live_heap_bytes(void)
+{
+	return __atomic_load_n(&heap_bytes, __ATOMIC_RELAXED);
+}
+#else
+static void start_heap_count(void)
+{
+}
+
+static long live_heap_bytes(void)
+{
+	return mallinfo2().uordblks;
+}
+#endif
+#endif
+
+/**
+ * check_heap() - make sure the heap is not growing, in test builds
+ *
+ * This is called after each input, and aborts once the heap, less the
+ * history, has grown by more than HEAP_GROWTH_MAX since the warm-up.
+ */
+static void check_heap(void)
+{
+#ifdef TEST_BUILD
+	static unsigned long inputs;
+	static long baseline;
+	long live;
+
+	if (!inputs)
+		start_heap_count();
+	live = live_heap_bytes() - history_heap_bytes;
+	if (++inputs == HEAP_WARMUP_INPUTS) {
+		baseline = live;
+	} else if (inputs > HEAP_WARMUP_INPUTS &&
+		   live - baseline > HEAP_GROWTH_MAX) {
+		fprintf(stderr,
+			"interact: heap grew by %ld bytes over %lu inputs\n",
+			live - baseline, inputs - HEAP_WARMUP_INPUTS);
+		abort();
+	}
+#endif
+}
 
 /**
  * maybe_add_history - Add to history only if string has length and
@@ -22,9 +224,156 @@
  */
 static void maybe_add_history(const char *string)
 {
+#ifdef TEST_BUILD
+	long before = live_heap_bytes();
+#endif
+
 	if (string[0] == '\0' || isspace(string[0]))
 		return;
 	add_history(string);
+	if (!strchr(string, '\n'))
+		hist_index_add(string);
+#ifdef TEST_BUILD
+	history_heap_bytes += live_heap_bytes() - before;
+#endif
+}
+
+/**
+ * autosuggestion() - suggest the rest of a line from the history
+ *
+ * Return: the remainder of the most recent history entry starting
+ * with @line, or NULL if there is none.
+ */
+static const char *autosuggestion(const char *line)
+{
+	const char *match;
+
+	if (!line[0])
+		return NULL;
+	match = hist_index_lookup(line);
+	if (!match)
+		return NULL;
+	match += strlen(line);
+	return *match ? match : NULL;
+}
+
+#ifndef NO_READLINE
+/* Whether an autosuggestion is drawn after the readline line. */
+static bool suggestion_shown;
+
+static int display_width(const char *s, size_t len)
+{
+	int width = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			width++;
+	}
+	return width;
+}
+
+/**
+ * suggest_redisplay() - readline redisplay hook drawing suggestions
+ *
+ * When the cursor is at the end of the line, the suggestion is drawn
+ * in dim text after it, truncated to the end of the terminal row.
+ * Readline is unaware of it, so the line is redrawn in full when a
+ * suggestion needs to be removed.
+ */
+static void suggest_redisplay(void)
+{
+	const char *suggestion = NULL;
+	const char *prompt = rl_display_prompt ? rl_display_prompt : "";
+	int rows, cols, col, width;
+	size_t len;
+
+	if (rl_point == rl_end)
+		suggestion = autosuggestion(rl_line_buffer);
+
+	if (!suggestion && suggestion_shown) {
+		suggestion_shown = false;
+		rl_forced_update_display();
+		return;
+	}
+
+	rl_redisplay();
+	if (!suggestion)
+		return;
+
+	rl_get_screen_size(&rows, &cols);
+	col = (display_width(prompt, strlen(prompt)) +
+	       display_width(rl_line_buffer, rl_end)) %
+	      (cols ? cols : 80);
+	width = cols - col - 1;
+	for (len = 0; suggestion[len] && width > 0; len++) {
+		if ((suggestion[len + 1] & 0xc0) != 0x80)
+			width--;
+	}
+
+	fprintf(rl_outstream, "\x1b[0K");
+	if (len) {
+		width = display_width(suggestion, len);
+		fprintf(rl_outstream, "\x1b[2m%.*s\x1b[0m\x1b[%dD", (int)len,
+			suggestion, width);
+	}
+	fflush(rl_outstream);
+	suggestion_shown = true;
+}
+
+/**
+ * accept_suggestion() - insert the suggestion, or move right
+ */
+static int accept_suggestion(int count, int key)
+{
+	const char *suggestion = NULL;
+
+	if (rl_point == rl_end)
+		suggestion = autosuggestion(rl_line_buffer);
+	if (!suggestion)
+		return rl_forward_char(count, key);
+
+	rl_insert_text(suggestion);
+	return 0;
+}
+
+/**
+ * accept_line() - erase any suggestion, then accept the line
+ */
+static int accept_line(int count, int key)
+{
+	if (suggestion_shown) {
+		fprintf(rl_outstream, "\x1b[0K");
+		fflush(rl_outstream);
+		suggestion_shown = false;
+	}
+	return rl_newline(count, key);
+}
+#endif
+
+/**
+ * setup_autosuggestions() - show suggestions from the history as the
+ * user types, accepted with the right arrow
+ */
+static void setup_autosuggestions(void)
+{
+	HIST_ENTRY **histlst = history_list();
+
+	for (; histlst && *histlst; histlst++) {
+		if (!strchr((*histlst)->line, '\n'))
+			hist_index_add((*histlst)->line);
+	}
+
+	if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+		return;
+
+	lineedit_hint_hook = autosuggestion;
+#ifndef NO_READLINE
+	rl_redisplay_function = suggest_redisplay;
+	rl_bind_keyseq("\\e[C", accept_suggestion);
+	rl_bind_keyseq("\\eOC", accept_suggestion);
+	rl_bind_key('\r', accept_line);
+	rl_bind_key('\n', accept_line);
+#endif
 }
 
 #define PROMPT_FMT "%s@%s %s %s $ "
@@ -33,10 +382,9 @@ char *default_prompt_generator(int last_return_code)
 {
 	char user_buf[256];
 	char hostname_buf[256] = { 0 };
-	char cwd_buf[PATH_MAX];
 	const char *user = user_buf;
 	const char *hostname = hostname_buf;
-	const char *cwd = cwd_buf;
+	const char *cwd = workdir_get();
 	char *prompt;
 	size_t prompt_sz;
 	struct passwd *pw;
@@ -55,7 +403,8 @@ char *default_prompt_generator(int last_return_code)
 		hostname = "???";
 	}
 
-	if (!getcwd(cwd_buf, sizeof(cwd_buf))) {
+	/* The logical directory, as cd left it, saves a getcwd() each time. */
+	if (!cwd) {
 		fprintf(stderr, "Unable to get the current directory: %s\n",
 			strerror(errno));
 		cwd = "???";
@@ -63,58 +412,137 @@ char *default_prompt_generator(int last_return_code)
 
 	prompt_sz = strnlen(user, sizeof(user_buf) - 1) +
 		    strnlen(hostname, sizeof(hostname_buf) - 1) +
-		    strnlen(cwd, sizeof(cwd_buf) - 1) + sizeof(PROMPT_FMT);
+		    strlen(cwd) + sizeof(PROMPT_FMT);
 	prompt = malloc(prompt_sz);
 	snprintf(prompt, prompt_sz, PROMPT_FMT, user, hostname, cwd,
 		 last_return_code == 0 ? ":)" : ":(");
 	return prompt;
 }
 
+/**
+ * dispatch_lines() - run each line of an input in turn
+ *
+ * Readline returns a single line for ordinary input, but a bracketed
+ * paste arrives as one buffer holding every pasted line.  Those are
+ * run back-to-back here, with no prompt in between.  When the
+ * "paste-errexit" option is set, the remaining lines are skipped once
+ * one of them fails.
+ *
+ * @input:              The (history-expanded) input.  This buffer is
+ *                      modified in place.
+ * @last_rv:            The return value from the previous command.
+ * @dispatcher:         The callback function to execute each line.
+ * @shell_should_exit:  Output parameter, as for the dispatcher.
+ *
+ * Return: the return value of the last line dispatched.
+ */
+static int dispatch_lines(char *input, int last_rv,
+			  int (*dispatcher)(const char *line, int last_rv,
+					    bool *shell_should_exit),
+			  bool *shell_should_exit)
+{
+	char *saveptr;
+	char *line;
+
+	line = strtok_r(input, "\n", &saveptr);
+	if (!line)
+		return dispatcher("", last_rv, shell_should_exit);
+
+	while (line) {
+		last_rv = record_dispatch(line, last_rv, dispatcher,
+					  shell_should_exit);
+		if (*shell_should_exit)
+			break;
+		line = strtok_r(NULL, "\n", &saveptr);
+		if (line && last_rv &&
+		    shell_options[SHELL_OPTION_PASTE_ERREXIT]) {
+			fprintf(stderr,
+				"paste-errexit: skipping remaining lines\n");
+			break;
+		}
+	}
+
+	return last_rv;
+}
+
+/**
+ * interact_once() - prompt for, expand and run a single input
+ *
+ * Background jobs which have finished are reported before the prompt.
+ * All buffers acquired here are released before returning,
+ * whichever way history expansion goes, which check_heap() and
+ * util/leak-check make sure of.
+ *
+ * Return: true when the shell should exit.
+ */
+static bool interact_once(char *(*prompt_generator)(int last_return_code),
+			  int (*dispatcher)(const char *line, int last_rv,
+					    bool *shell_should_exit),
+			  int *last_return)
+{
+	char *prompt;
+	char *line;
+	char *expanded_line = NULL;
+	uint64_t start;
+	int history_rv;
+	bool shell_should_exit = false;
+
+	jobs_update(true);
+	prompt = prompt_generator(*last_return);
+	start = stats_now_ns();
+	line = read_line(prompt);
+	trace_span("readline", start, NULL, NULL, 0);
+	free(prompt);
+	if (!line)
+		line = strdup("exit");
+
+	start = stats_now_ns();
+	history_rv = history_expand(line, &expanded_line);
+	trace_span("history_expand", start, NULL, "rv", history_rv);
+
+	if (history_rv != 0)
+		fprintf(stderr, "%s\n", expanded_line);
+
+	if (history_rv < 0) {
+		maybe_add_history(line);
+		goto out;
+	}
+	maybe_add_history(expanded_line);
+
+	if (history_rv == 2)
+		goto out;
+
+	*last_return = dispatch_lines(expanded_line, *last_return, dispatcher,
+				      &shell_should_exit);
+
+out:
+	free(line);
+	free(expanded_line);
+	return shell_should_exit;
+}
+
 int interact(char *(*prompt_generator)(int last_return_code),
 	     int (*dispatcher)(const char *line, int last_rv,
 			       bool *shell_should_exit))
 {
-	char *line = NULL;
-	char *expanded_line = NULL;
-	char *prompt;
-	int history_rv;
 	int last_return = 0;
 	bool shell_should_exit;
 
+#ifndef NO_READLINE
 	rl_catch_signals = 1;
 	rl_set_signals();
+	rl_variable_bind("enable-bracketed-paste", "on");
+#endif
 
 	using_history();
 	read_history(NULL);
+	setup_autosuggestions();
 
-	for (;;) {
-		prompt = prompt_generator(last_return);
-		line = readline(prompt);
-		free(prompt);
-		if (!line)
-			line = strdup("exit");
-		history_rv = history_expand(line, &expanded_line);
-
-		if (history_rv != 0)
-			fprintf(stderr, "%s\n", expanded_line);
-
-		if (history_rv < 0) {
-			maybe_add_history(line);
-			continue;
-		} else {
-			maybe_add_history(expanded_line);
-		}
-
-		if (history_rv == 2)
-			continue;
+	do {
+		shell_should_exit = interact_once(prompt_generator, dispatcher,
+						  &last_return);
+		check_heap();
+	} while (!shell_should_exit);
 
-		shell_should_exit = false;
-		last_return = dispatcher(expanded_line, last_return,
-					 &shell_should_exit);
-		free(line);
-		free(expanded_line);
-
-		if (shell_should_exit)
-			return last_return;
-	}
+	return last_return;
 }
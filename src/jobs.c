@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "output.h"
+#include "probes.h"
+
+struct job_proc {
+	pid_t pid;
+	/* A pidfd for the process, or -1 if pidfds are not available. */
+	int pidfd;
+	bool reaped;
+	int status;
+};
+
+struct job {
+	int id;
+	char *cmdline;
+	struct job_proc *procs;
+	size_t n_procs;
+	/* The processes which have not been reaped yet. */
+	size_t running;
+};
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The jobs, oldest first.  The last is the current job, "%+". */
+static struct job *jobs;
+static size_t n_jobs;
+
+int jobs_add(const pid_t pids[], size_t n_pids, const char *cmdline)
+{
+	struct job *job;
+	size_t len = strlen(cmdline);
+	int id;
+
+	while (len && strchr(" \f\n\r\t\v", cmdline[len - 1]))
+		len--;
+
+	pthread_mutex_lock(&jobs_lock);
+	jobs = realloc(jobs, (n_jobs + 1) * sizeof(*jobs));
+	job = &jobs[n_jobs];
+	id = n_jobs ? jobs[n_jobs - 1].id + 1 : 1;
+	n_jobs++;
+
+	job->id = id;
+	job->cmdline = strndup(cmdline, len);
+	job->procs = calloc(n_pids, sizeof(*job->procs));
+	job->n_procs = n_pids;
+	job->running = n_pids;
+	for (size_t i = 0; i < n_pids; i++) {
+		job->procs[i].pid = pids[i];
+		job->procs[i].pidfd = pidfd_open(pids[i], 0);
+	}
+	pthread_mutex_unlock(&jobs_lock);
+	return id;
+}
+
+static void forget_job(size_t index)
+{
+	struct job *job = &jobs[index];
+
+	for (size_t i = 0; i < job->n_procs; i++) {
+		if (job->procs[i].pidfd >= 0)
+			close(job->procs[i].pidfd);
+	}
+	free(job->procs);
+	free(job->cmdline);
+	memmove(job, job + 1, (n_jobs - index - 1) * sizeof(*job));
+	n_jobs--;
+}
+
+static void reap_job(struct job *job)
+{
+	struct job_proc *proc;
+
+	for (size_t i = 0; i < job->n_procs && job->running; i++) {
+		proc = &job->procs[i];
+		if (proc->reaped ||
+		    waitpid(proc->pid, &proc->status, WNOHANG) != proc->pid)
+			continue;
+		PROBE2(child_reap, proc->pid, proc->status);
+		proc->reaped = true;
+		job->running--;
+	}
+}
+
+/**
+ * job_state() - describe a job as "jobs" does
+ *
+ * A finished job is described by how its last process exited.
+ *
+ * Return: the description, in @buf or a static string.
+ */
+static const char *job_state(const struct job *job, char *buf, size_t size)
+{
+	int status = job->procs[job->n_procs - 1].status;
+
+	if (job->running)
+		return "Running";
+	if (WIFSIGNALED(status))
+		return strsignal(WTERMSIG(status));
+	if (WEXITSTATUS(status)) {
+		snprintf(buf, size, "Exit %d", WEXITSTATUS(status));
+		return buf;
+	}
+	return "Done";
+}
+
+static char job_marker(size_t index)
+{
+	if (index + 1 == n_jobs)
+		return '+';
+	if (index + 2 == n_jobs)
+		return '-';
+	return ' ';
+}
+
+void jobs_update(bool notify)
+{
+	char buf[32];
+
+	pthread_mutex_lock(&jobs_lock);
+	for (size_t i = 0; i < n_jobs; i++)
+		reap_job(&jobs[i]);
+
+	for (size_t i = 0; notify && i < n_jobs; i++) {
+		if (!jobs[i].running)
+			fprintf(stderr, "[%d]%c  %-24s%s\n", jobs[i].id,
+				job_marker(i),
+				job_state(&jobs[i], buf, sizeof(buf)),
+				jobs[i].cmdline);
+	}
+	for (size_t i = n_jobs; notify && i-- > 0;) {
+		if (!jobs[i].running)
+			forget_job(i);
+	}
+	pthread_mutex_unlock(&jobs_lock);
+}
+
+void jobs_print(bool show_pids)
+{
+	char buf[32];
+	struct job *job;
+
+	pthread_mutex_lock(&jobs_lock);
+	for (size_t i = 0; i < n_jobs; i++) {
+		job = &jobs[i];
+		reap_job(job);
+		bout_printf("[%d]%c ", job->id, job_marker(i));
+		for (size_t j = 0; show_pids && j < job->n_procs; j++)
+			bout_printf("%d ", job->procs[j].pid);
+		bout_printf(" %-24s%s\n", job_state(job, buf, sizeof(buf)),
+			    job->cmdline);
+	}
+
+	for (size_t i = n_jobs; i-- > 0;) {
+		if (!jobs[i].running)
+			forget_job(i);
+	}
+	pthread_mutex_unlock(&jobs_lock);
+}
+
+/**
+ * find_job() - look up a job spec, without its leading "%"
+ *
+ * Return: the job, or NULL if there is none.
+ */
+static struct job *find_job(const char *spec)
+{
+	char *end;
+	long id;
+
+	if (!n_jobs)
+		return NULL;
+	if (!*spec || !strcmp(spec, "%") || !strcmp(spec, "+"))
+		return &jobs[n_jobs - 1];
+	if (!strcmp(spec, "-"))
+		return n_jobs > 1 ? &jobs[n_jobs - 2] : NULL;
+
+	id = strtol(spec, &end, 10);
+	for (size_t i = n_jobs; i-- > 0;) {
+		if (*end ? !strncmp(jobs[i].cmdline, spec, strlen(spec)) :
+			   jobs[i].id == id)
+			return &jobs[i];
+	}
+	return NULL;
+}
+
+/**
+ * signal_proc() - signal a process of a job
+ *
+ * Without pidfds, the pid is only used while the process is unreaped,
+ * as it cannot have been reused until then.
+ *
+ * Return: zero on success, or -1 on failure, with errno set.
+ */
+static int signal_proc(const struct job_proc *proc, int sig)
+{
+	if (proc->pidfd >= 0)
+		return pidfd_send_signal(proc->pidfd, sig, NULL, 0);
+	if (proc->reaped) {
+		errno = ESRCH;
+		return -1;
+	}
+	return kill(proc->pid, sig);
+}
+
+/**
+ * signal_job() - signal every process of a job
+ *
+ * Processes which have already exited are skipped, unless they all
+ * have.
+ */
+static int signal_job(const struct job *job, int sig, const char *target)
+{
+	size_t exited = 0;
+	int rv = 0;
+
+	for (size_t i = 0; i < job->n_procs; i++) {
+		if (!signal_proc(&job->procs[i], sig))
+			continue;
+		if (errno == ESRCH) {
+			exited++;
+			continue;
+		}
+		fprintf(stderr, "kill: %s: %d: %s\n", target,
+			job->procs[i].pid, strerror(errno));
+		rv = -1;
+	}
+	if (exited == job->n_procs) {
+		fprintf(stderr, "kill: %s: job has terminated\n", target);
+		rv = -1;
+	}
+	return rv;
+}
+
+/**
+ * signal_pid() - signal a process which is not in the job table
+ */
+static int signal_pid(pid_t pid, int sig, const char *target)
+{
+	int pidfd = pidfd_open(pid, 0);
+	int rv;
+
+	if (pidfd >= 0) {
+		rv = pidfd_send_signal(pidfd, sig, NULL, 0);
+		close(pidfd);
+	} else {
+		rv = errno == ENOSYS ? kill(pid, sig) : -1;
+	}
+	if (rv < 0)
+		fprintf(stderr, "kill: %s: %s\n", target, strerror(errno));
+	return rv;
+}
+
+int jobs_signal(const char *target, int sig, bool group)
+{
+	struct job_proc *proc;
+	struct job *job;
+	char *end;
+	long pid = 0;
+	int rv;
+
+	if (target[0] != '%') {
+		pid = strtol(target, &end, 10);
+		if (*end || end == target || pid <= 0) {
+			fprintf(stderr,
+				"kill: %s: arguments must be process or job IDs\n",
+				target);
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&jobs_lock);
+	if (target[0] == '%') {
+		job = find_job(target + 1);
+		if (job) {
+			rv = signal_job(job, sig, target);
+		} else {
+			fprintf(stderr, "kill: %s: no such job\n", target);
+			rv = -1;
+		}
+		goto out;
+	}
+
+	/* Only unreaped processes, since a reaped one's pid may be reused. */
+	for (size_t i = 0; i < n_jobs; i++) {
+		job = &jobs[i];
+		for (size_t j = 0; j < job->n_procs; j++) {
+			proc = &job->procs[j];
+			if (proc->pid != pid || proc->reaped)
+				continue;
+			if (group) {
+				rv = signal_job(job, sig, target);
+			} else {
+				rv = signal_proc(proc, sig);
+				if (rv < 0)
+					fprintf(stderr, "kill: %s: %s\n",
+						target, strerror(errno));
+			}
+			goto out;
+		}
+	}
+
+	if (group) {
+		fprintf(stderr, "kill: %s: not a process of a job\n", target);
+		rv = -1;
+	} else {
+		rv = signal_pid(pid, sig, target);
+	}
+out:
+	pthread_mutex_unlock(&jobs_lock);
+	return rv;
+}
@@ -0,0 +1,741 @@
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include <readline/history.h>
+
+#include "lineedit.h"
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 0x1b
+#define KEY_BACKSPACE 0x7f
+
+/* The characters which end a word for completion purposes. */
+#define WORD_BREAKS " \t\n<>|"
+
+/* A growable byte buffer. */
+struct ebuf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+/* The state of the line being edited. */
+struct edit_state {
+	/* The line, always NUL-terminated at buf.len. */
+	struct ebuf buf;
+
+	/* The cursor, as a byte offset in buf. */
+	size_t pos;
+
+	const char *prompt;
+
+	/*
+	 * The history entry being shown, as an offset in the history
+	 * list.  history_length is the new line, whose contents are
+	 * kept in "saved" while browsing.
+	 */
+	int hist_index;
+	char *saved;
+
+	/* Whether the last key pressed was TAB. */
+	bool last_was_tab;
+
+	/* Whether the line has been accepted, so no hint is drawn. */
+	bool done;
+};
+
+static char **filename_completion(const char *text, int start, int end);
+
+lineedit_completion_func_t *lineedit_completion_hook = filename_completion;
+
+const char *(*lineedit_hint_hook)(const char *line);
+
+static void ebuf_reserve(struct ebuf *eb, size_t extra)
+{
+	if (eb->len + extra + 1 <= eb->cap)
+		return;
+	eb->cap = eb->cap ? eb->cap : 128;
+	while (eb->len + extra + 1 > eb->cap)
+		eb->cap *= 2;
+	eb->data = realloc(eb->data, eb->cap);
+}
+
+static void ebuf_insert(struct ebuf *eb, size_t at, const char *s, size_t n)
+{
+	ebuf_reserve(eb, n);
+	memmove(eb->data + at + n, eb->data + at, eb->len - at);
+	memcpy(eb->data + at, s, n);
+	eb->len += n;
+	eb->data[eb->len] = '\0';
+}
+
+static void ebuf_append(struct ebuf *eb, const char *s, size_t n)
+{
+	ebuf_insert(eb, eb->len, s, n);
+}
+
+static void ebuf_delete(struct ebuf *eb, size_t at, size_t n)
+{
+	memmove(eb->data + at, eb->data + at + n, eb->len - at - n);
+	eb->len -= n;
+	eb->data[eb->len] = '\0';
+}
+
+static void ebuf_set(struct ebuf *eb, const char *s)
+{
+	eb->len = 0;
+	ebuf_append(eb, s, strlen(s));
+}
+
+/**
+ * utf8_next() - find the start of the character after @pos
+ */
+static size_t utf8_next(const char *s, size_t len, size_t pos)
+{
+	if (pos >= len)
+		return len;
+	pos++;
+	while (pos < len && (s[pos] & 0xc0) == 0x80)
+		pos++;
+	return pos;
+}
+
+/**
+ * utf8_prev() - find the start of the character before @pos
+ */
+static size_t utf8_prev(const char *s, size_t pos)
+{
+	if (!pos)
+		return 0;
+	pos--;
+	while (pos && (s[pos] & 0xc0) == 0x80)
+		pos--;
+	return pos;
+}
+
+/**
+ * char_width() - get the number of columns a character is displayed in
+ *
+ * Control characters are displayed in caret notation (e.g. "^J"), and
+ * invalid sequences are displayed byte by byte.
+ *
+ * @s:        The string.
+ * @len:      The length of the string.
+ * @nbytes:   Output parameter for the length of the character.
+ */
+static int char_width(const char *s, size_t len, size_t *nbytes)
+{
+	mbstate_t ps;
+	wchar_t wc;
+	size_t n;
+	int width;
+
+	if ((unsigned char)s[0] < 0x80) {
+		*nbytes = 1;
+		return iscntrl((unsigned char)s[0]) ? 2 : 1;
+	}
+
+	memset(&ps, 0, sizeof(ps));
+	n = mbrtowc(&wc, s, len, &ps);
+	if (n == (size_t)-1 || n == (size_t)-2 || !n) {
+		*nbytes = 1;
+		return 1;
+	}
+	*nbytes = n;
+	width = wcwidth(wc);
+	return width < 0 ? 1 : width;
+}
+
+static int str_width(const char *s, size_t len)
+{
+	size_t n;
+	int width = 0;
+
+	for (size_t i = 0; i < len; i += n)
+		width += char_width(s + i, len - i, &n);
+	return width;
+}
+
+static void render_chars(struct ebuf *out, const char *s, size_t len)
+{
+	char caret[2];
+	size_t n;
+
+	for (size_t i = 0; i < len; i += n) {
+		char_width(s + i, len - i, &n);
+		if (n == 1 && iscntrl((unsigned char)s[i])) {
+			caret[0] = '^';
+			caret[1] = s[i] ^ 0x40;
+			ebuf_append(out, caret, 2);
+		} else {
+			ebuf_append(out, s + i, n);
+		}
+	}
+}
+
+static int terminal_columns(void)
+{
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || !ws.ws_col)
+		return 80;
+	return ws.ws_col;
+}
+
+static void write_all(const char *s, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(STDOUT_FILENO, s, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		s += n;
+		len -= n;
+	}
+}
+
+/**
+ * refresh_line() - redraw the prompt and line
+ *
+ * The line is drawn on a single terminal row.  When it does not fit,
+ * it is scrolled horizontally to keep the cursor visible.
+ */
+static void refresh_line(struct edit_state *es)
+{
+	struct ebuf out = { 0 };
+	const char *s = es->buf.data;
+	const char *hint = NULL;
+	size_t start = 0;
+	size_t end = es->buf.len;
+	size_t hint_end = 0;
+	int cols = terminal_columns();
+	int prompt_width = str_width(es->prompt, strlen(es->prompt));
+	int avail = cols - prompt_width - 1;
+	char seq[32];
+	int cursor_col;
+	size_t n;
+
+	if (avail < 1)
+		avail = 1;
+
+	/* Scroll so the cursor fits. */
+	while (str_width(s + start, es->pos - start) > avail)
+		start = utf8_next(s, es->buf.len, start);
+
+	/* And trim whatever doesn't fit after it. */
+	while (str_width(s + start, end - start) > avail)
+		end = utf8_prev(s, end);
+
+	/* Draw as much of the hint as fits after the line. */
+	if (!es->done && es->pos == es->buf.len && lineedit_hint_hook)
+		hint = lineedit_hint_hook(s);
+	if (hint) {
+		avail -= str_width(s + start, end - start);
+		while (hint[hint_end]) {
+			n = utf8_next(hint, strlen(hint), hint_end);
+			if (str_width(hint, n) > avail)
+				break;
+			hint_end = n;
+		}
+	}
+
+	ebuf_append(&out, "\r", 1);
+	ebuf_append(&out, es->prompt, strlen(es->prompt));
+	render_chars(&out, s + start, end - start);
+	if (hint_end) {
+		ebuf_append(&out, "\x1b[2m", 4);
+		render_chars(&out, hint, hint_end);
+		ebuf_append(&out, "\x1b[0m", 4);
+	}
+	ebuf_append(&out, "\x1b[0K\r", 5);
+	cursor_col = prompt_width + str_width(s + start, es->pos - start);
+	if (cursor_col) {
+		n = snprintf(seq, sizeof(seq), "\x1b[%dC", cursor_col);
+		ebuf_append(&out, seq, n);
+	}
+
+	write_all(out.data, out.len);
+	free(out.data);
+}
+
+static int read_byte(void)
+{
+	unsigned char c;
+	ssize_t n;
+
+	do {
+		n = read(STDIN_FILENO, &c, 1);
+	} while (n < 0 && errno == EINTR);
+
+	return n == 1 ? c : -1;
+}
+
+static void insert_text(struct edit_state *es, const char *s, size_t n)
+{
+	ebuf_insert(&es->buf, es->pos, s, n);
+	es->pos += n;
+}
+
+/**
+ * insert_char() - insert a typed character, and any UTF-8
+ * continuation bytes following it
+ */
+static void insert_char(struct edit_state *es, int c)
+{
+	char mb[4] = { c };
+	size_t n = 1;
+	size_t want = 1;
+	int next;
+
+	if ((c & 0xe0) == 0xc0)
+		want = 2;
+	else if ((c & 0xf0) == 0xe0)
+		want = 3;
+	else if ((c & 0xf8) == 0xf0)
+		want = 4;
+
+	while (n < want && (next = read_byte()) >= 0)
+		mb[n++] = next;
+	insert_text(es, mb, n);
+}
+
+/**
+ * read_paste() - insert the contents of a bracketed paste
+ *
+ * Everything up to the closing "\e[201~" is inserted literally, with
+ * carriage returns translated to newlines.
+ */
+static void read_paste(struct edit_state *es)
+{
+	static const char end_marker[] = "\x1b[201~";
+	struct ebuf paste = { 0 };
+	size_t marker_len = sizeof(end_marker) - 1;
+	int c;
+
+	while ((c = read_byte()) >= 0) {
+		char ch = c == '\r' ? '\n' : c;
+
+		ebuf_append(&paste, &ch, 1);
+		if (paste.len >= marker_len &&
+		    !memcmp(paste.data + paste.len - marker_len, end_marker,
+			    marker_len)) {
+			paste.len -= marker_len;
+			break;
+		}
+	}
+
+	if (paste.len)
+		insert_text(es, paste.data, paste.len);
+	free(paste.data);
+}
+
+static void history_move(struct edit_state *es, int dir)
+{
+	int target = es->hist_index + dir;
+	HIST_ENTRY *entry;
+
+	if (target < 0 || target > history_length)
+		return;
+
+	if (es->hist_index == history_length) {
+		free(es->saved);
+		es->saved = strdup(es->buf.data);
+	}
+
+	if (target == history_length) {
+		ebuf_set(&es->buf, es->saved);
+	} else {
+		entry = history_get(history_base + target);
+		if (!entry)
+			return;
+		ebuf_set(&es->buf, entry->line);
+	}
+	es->hist_index = target;
+	es->pos = es->buf.len;
+}
+
+static size_t word_start(const struct edit_state *es)
+{
+	size_t start = es->pos;
+
+	while (start && !strchr(WORD_BREAKS, es->buf.data[start - 1]))
+		start--;
+	return start;
+}
+
+static void free_matches(char **matches)
+{
+	for (char **m = matches; *m; m++)
+		free(*m);
+	free(matches);
+}
+
+static size_t common_prefix_len(char **matches)
+{
+	size_t len = strlen(matches[0]);
+
+	for (char **m = matches + 1; *m; m++) {
+		size_t i = 0;
+
+		while (i < len && (*m)[i] == matches[0][i])
+			i++;
+		len = i;
+	}
+	return len;
+}
+
+static void list_matches(struct edit_state *es, char **matches)
+{
+	struct ebuf out = { 0 };
+
+	ebuf_append(&out, "\r\n", 2);
+	for (char **m = matches; *m; m++) {
+		ebuf_append(&out, *m, strlen(*m));
+		ebuf_append(&out, m[1] ? "  " : "\r\n", 2);
+	}
+	write_all(out.data, out.len);
+	free(out.data);
+}
+
+/**
+ * complete() - complete the word before the cursor
+ *
+ * A single match replaces the word.  With several matches, their
+ * longest common prefix is inserted, and pressing TAB again lists
+ * them.
+ */
+static void complete(struct edit_state *es)
+{
+	size_t start = word_start(es);
+	char *word;
+	char **matches;
+	size_t prefix;
+
+	if (!lineedit_completion_hook)
+		return;
+
+	word = strndup(es->buf.data + start, es->pos - start);
+	matches = lineedit_completion_hook(word, start, es->pos);
+	free(word);
+
+	if (!matches || !matches[0]) {
+		write_all("\a", 1);
+		free(matches);
+		return;
+	}
+
+	prefix = common_prefix_len(matches);
+	if (prefix > es->pos - start) {
+		ebuf_delete(&es->buf, start, es->pos - start);
+		es->pos = start;
+		insert_text(es, matches[0], prefix);
+		if (!matches[1] && matches[0][prefix - 1] != '/')
+			insert_text(es, " ", 1);
+	} else if (matches[1] && es->last_was_tab) {
+		list_matches(es, matches);
+	} else {
+		write_all("\a", 1);
+	}
+	free_matches(matches);
+}
+
+/**
+ * accept_hint() - insert the hint, if the cursor is at the end
+ *
+ * Return: true if a hint was inserted.
+ */
+static bool accept_hint(struct edit_state *es)
+{
+	const char *hint;
+
+	if (es->pos != es->buf.len || !lineedit_hint_hook)
+		return false;
+	hint = lineedit_hint_hook(es->buf.data);
+	if (!hint)
+		return false;
+	insert_text(es, hint, strlen(hint));
+	return true;
+}
+
+/**
+ * handle_escape() - handle the remainder of an escape sequence
+ */
+static void handle_escape(struct edit_state *es)
+{
+	char seq[8];
+	size_t n = 0;
+	int c;
+
+	if ((c = read_byte()) < 0)
+		return;
+	if (c != '[' && c != 'O')
+		return;
+
+	/* Read the parameters and final byte of a CSI sequence. */
+	while (n < sizeof(seq) - 1 && (c = read_byte()) >= 0) {
+		seq[n++] = c;
+		if (c >= 0x40 && c <= 0x7e)
+			break;
+	}
+	seq[n] = '\0';
+
+	if (!strcmp(seq, "A")) {
+		history_move(es, -1);
+	} else if (!strcmp(seq, "B")) {
+		history_move(es, 1);
+	} else if (!strcmp(seq, "C")) {
+		if (!accept_hint(es))
+			es->pos = utf8_next(es->buf.data, es->buf.len,
+					    es->pos);
+	} else if (!strcmp(seq, "D")) {
+		es->pos = utf8_prev(es->buf.data, es->pos);
+	} else if (!strcmp(seq, "H") || !strcmp(seq, "1~")) {
+		es->pos = 0;
+	} else if (!strcmp(seq, "F") || !strcmp(seq, "4~")) {
+		es->pos = es->buf.len;
+	} else if (!strcmp(seq, "3~")) {
+		if (es->pos < es->buf.len)
+			ebuf_delete(&es->buf, es->pos,
+				    utf8_next(es->buf.data, es->buf.len,
+					      es->pos) -
+					    es->pos);
+	} else if (!strcmp(seq, "200~")) {
+		read_paste(es);
+	}
+}
+
+/**
+ * handle_key() - apply a key press to the line
+ *
+ * Return: 1 when the line is complete, -1 at end-of-file, or 0 to
+ * keep editing.
+ */
+static int handle_key(struct edit_state *es, int c)
+{
+	size_t start;
+
+	switch (c) {
+	case '\r':
+	case '\n':
+		return 1;
+	case KEY_CTRL('D'):
+		if (!es->buf.len)
+			return -1;
+		if (es->pos < es->buf.len)
+			ebuf_delete(&es->buf, es->pos,
+				    utf8_next(es->buf.data, es->buf.len,
+					      es->pos) -
+					    es->pos);
+		break;
+	case KEY_CTRL('C'):
+		write_all("^C\r\n", 4);
+		es->buf.len = 0;
+		es->buf.data[0] = '\0';
+		es->pos = 0;
+		es->hist_index = history_length;
+		break;
+	case KEY_BACKSPACE:
+	case KEY_CTRL('H'):
+		start = utf8_prev(es->buf.data, es->pos);
+		ebuf_delete(&es->buf, start, es->pos - start);
+		es->pos = start;
+		break;
+	case KEY_CTRL('A'):
+		es->pos = 0;
+		break;
+	case KEY_CTRL('E'):
+		es->pos = es->buf.len;
+		break;
+	case KEY_CTRL('B'):
+		es->pos = utf8_prev(es->buf.data, es->pos);
+		break;
+	case KEY_CTRL('F'):
+		es->pos = utf8_next(es->buf.data, es->buf.len, es->pos);
+		break;
+	case KEY_CTRL('K'):
+		es->buf.len = es->pos;
+		es->buf.data[es->pos] = '\0';
+		break;
+	case KEY_CTRL('U'):
+		ebuf_delete(&es->buf, 0, es->pos);
+		es->pos = 0;
+		break;
+	case KEY_CTRL('W'):
+		start = es->pos;
+		while (start && isspace((unsigned char)es->buf.data[start - 1]))
+			start--;
+		while (start &&
+		       !isspace((unsigned char)es->buf.data[start - 1]))
+			start--;
+		ebuf_delete(&es->buf, start, es->pos - start);
+		es->pos = start;
+		break;
+	case KEY_CTRL('P'):
+		history_move(es, -1);
+		break;
+	case KEY_CTRL('N'):
+		history_move(es, 1);
+		break;
+	case KEY_CTRL('L'):
+		write_all("\x1b[H\x1b[2J", 7);
+		break;
+	case '\t':
+		complete(es);
+		break;
+	case KEY_ESC:
+		handle_escape(es);
+		break;
+	default:
+		if (c >= 0x20)
+			insert_char(es, c);
+		break;
+	}
+	return 0;
+}
+
+/**
+ * read_line_plain() - read a line when input is not a terminal
+ *
+ * The prompt and line are echoed, as readline does.
+ */
+static char *read_line_plain(const char *prompt)
+{
+	char *line = NULL;
+	size_t sz = 0;
+	ssize_t len;
+
+	fputs(prompt, stdout);
+	fflush(stdout);
+	len = getline(&line, &sz, stdin);
+	if (len < 0) {
+		free(line);
+		return NULL;
+	}
+	if (len && line[len - 1] == '\n')
+		line[--len] = '\0';
+	printf("%s\n", line);
+	return line;
+}
+
+char *lineedit(const char *prompt)
+{
+	static bool locale_set;
+	struct edit_state es = { 0 };
+	struct termios orig, raw;
+	int c, rv = 0;
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &orig) < 0)
+		return read_line_plain(prompt);
+
+	if (!locale_set) {
+		setlocale(LC_CTYPE, "");
+		locale_set = true;
+	}
+
+	raw = orig;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0)
+		return read_line_plain(prompt);
+
+	/* Enable bracketed paste while editing. */
+	write_all("\x1b[?2004h", 8);
+
+	es.prompt = prompt;
+	es.hist_index = history_length;
+	ebuf_reserve(&es.buf, 0);
+	es.buf.data[0] = '\0';
+	refresh_line(&es);
+
+	while (!rv) {
+		c = read_byte();
+		if (c < 0) {
+			rv = -1;
+			break;
+		}
+		rv = handle_key(&es, c);
+		es.last_was_tab = c == '\t';
+		es.done = rv != 0;
+		refresh_line(&es);
+	}
+
+	write_all("\x1b[?2004l\r\n", 10);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig);
+	free(es.saved);
+
+	if (rv < 0) {
+		free(es.buf.data);
+		return NULL;
+	}
+	return es.buf.data;
+}
+
+static char **filename_completion(const char *text, int start, int end)
+{
+	const char *slash = strrchr(text, '/');
+	size_t dir_len = slash ? slash - text + 1 : 0;
+	const char *prefix = text + dir_len;
+	size_t prefix_len = strlen(prefix);
+	char *dir_path;
+	char **matches = NULL;
+	size_t n = 0;
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+
+	dir_path = dir_len ? strndup(text, dir_len) : strdup(".");
+	dir = opendir(dir_path);
+	free(dir_path);
+	if (!dir)
+		return NULL;
+
+	while ((ent = readdir(dir))) {
+		bool is_dir;
+		size_t name_len = strlen(ent->d_name);
+		char *match;
+
+		if (strncmp(ent->d_name, prefix, prefix_len))
+			continue;
+		if (ent->d_name[0] == '.' && prefix[0] != '.')
+			continue;
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+
+		is_dir = ent->d_type == DT_DIR;
+		if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+			is_dir = !fstatat(dirfd(dir), ent->d_name, &st, 0) &&
+				 S_ISDIR(st.st_mode);
+
+		match = malloc(dir_len + name_len + 2);
+		memcpy(match, text, dir_len);
+		memcpy(match + dir_len, ent->d_name, name_len);
+		strcpy(match + dir_len + name_len, is_dir ? "/" : "");
+
+		matches = realloc(matches, (n + 2) * sizeof(*matches));
+		matches[n++] = match;
+		matches[n] = NULL;
+	}
+	closedir(dir);
+	return matches;
+}
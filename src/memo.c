@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dispatcher.h"
+#include "memo.h"
+#include "output.h"
+#include "pathcache.h"
+#include "shell_builtins.h"
+#include "stats.h"
+#include "variables.h"
+#include "workdir.h"
+
+#define MEMO_MAGIC "SHMEMO01"
+#define MEMO_DEFAULT_MAX_SIZE (64ULL << 20)
+
+/* Keys are two 64-bit hashes, in hex. */
+#define MEMO_KEY_LEN 32
+
+/*
+ * An entry is this header, followed by the standard output and then
+ * the standard error of the command.
+ */
+struct memo_entry_header {
+	char magic[8];
+	int32_t status;
+	uint32_t reserved;
+	uint64_t stdout_len;
+	uint64_t stderr_len;
+};
+
+/*
+ * Two independent FNV-style hashes, with different multipliers, for a
+ * 128-bit key.  A collision would replay the wrong output, so 32 bits
+ * is not enough, but nothing here needs to resist an attacker.
+ */
+struct key_hash {
+	uint64_t a;
+	uint64_t b;
+};
+
+static void hash_bytes(struct key_hash *h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	for (size_t i = 0; i < len; i++) {
+		h->a = (h->a ^ p[i]) * 0x100000001b3ULL;
+		h->b = (h->b ^ p[i]) * 0x9e3779b97f4a7c15ULL;
+	}
+}
+
+/**
+ * hash_field() - hash a tagged, length-prefixed field
+ *
+ * The tag and length keep different inputs from running together,
+ * so "ab" + "c" and "a" + "bc" hash differently.
+ */
+static void hash_field(struct key_hash *h, char tag, const void *data,
+		       size_t len)
+{
+	uint64_t len64 = len;
+
+	hash_bytes(h, &tag, 1);
+	hash_bytes(h, &len64, sizeof(len64));
+	hash_bytes(h, data, len);
+}
+
+static void hash_string(struct key_hash *h, char tag, const char *str)
+{
+	hash_field(h, tag, str, strlen(str));
+}
+
+/* Hash everything in @fd, from the start. */
+static void hash_fd_contents(struct key_hash *h, int fd)
+{
+	char buf[65536];
+	uint64_t total = 0;
+	ssize_t n;
+
+	while ((n = pread(fd, buf, sizeof(buf), total)) > 0) {
+		hash_bytes(h, buf, n);
+		total += n;
+	}
+	hash_field(h, 'L', &total, sizeof(total));
+}
+
+static void hash_file_contents(struct key_hash *h, const char *path)
+{
+	int fd;
+
+	hash_string(h, 'F', path);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		hash_field(h, '!', NULL, 0);
+		return;
+	}
+	hash_fd_contents(h, fd);
+	close(fd);
+}
+
+static void hash_file_mtime(struct key_hash *h, const char *path)
+{
+	struct stat st;
+	uint64_t meta[5];
+
+	hash_string(h, 'M', path);
+	if (stat(path, &st) < 0) {
+		hash_field(h, '!', NULL, 0);
+		return;
+	}
+	meta[0] = st.st_size;
+	meta[1] = st.st_mtim.tv_sec;
+	meta[2] = st.st_mtim.tv_nsec;
+	meta[3] = st.st_ino;
+	meta[4] = st.st_dev;
+	hash_field(h, 'S', meta, sizeof(meta));
+}
+
+static const char *env_lookup(char *const envp[], const char *name)
+{
+	size_t len = strlen(name);
+
+	for (; *envp; envp++) {
+		if (!strncmp(*envp, name, len) && (*envp)[len] == '=')
+			return *envp + len + 1;
+	}
+	return NULL;
+}
+
+/**
+ * compute_key() - hash a command and its inputs into a key
+ *
+ * Besides the declared inputs, the key covers the command line, the
+ * current directory, the program, so a rebuilt or replaced one is run
+ * again, and the command's standard input, when it is an input.
+ *
+ * @exe:    The path of the program, or NULL for a builtin.
+ * @in_fd:  A seekable copy of the standard input, or -1 if it is not
+ *          an input.
+ */
+static void compute_key(const char *const argv[], char *const envp[],
+			const char *exe, int in_fd,
+			const struct memo_inputs *inputs,
+			char key[MEMO_KEY_LEN + 1])
+{
+	struct key_hash h = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+	const char *cwd = workdir_get();
+	const char *value;
+
+	for (; *argv; argv++)
+		hash_string(&h, 'A', *argv);
+	hash_string(&h, 'D', cwd ? cwd : "");
+
+	hash_field(&h, 'X', NULL, 0);
+	if (exe)
+		hash_file_mtime(&h, exe);
+	hash_field(&h, 'I', NULL, 0);
+	if (in_fd >= 0)
+		hash_fd_contents(&h, in_fd);
+
+	for (size_t i = 0; i < inputs->n_env_names; i++) {
+		hash_string(&h, 'E', inputs->env_names[i]);
+		value = env_lookup(envp, inputs->env_names[i]);
+		if (value)
+			hash_string(&h, 'V', value);
+		else
+			hash_field(&h, '!', NULL, 0);
+	}
+	for (size_t i = 0; i < inputs->n_content_files; i++)
+		hash_file_contents(&h, inputs->content_files[i]);
+	for (size_t i = 0; i < inputs->n_mtime_files; i++)
+		hash_file_mtime(&h, inputs->mtime_files[i]);
+
+	snprintf(key, MEMO_KEY_LEN + 1, "%016llx%016llx",
+		 (unsigned long long)h.a, (unsigned long long)h.b);
+}
+
+static bool is_entry_name(const char *name)
+{
+	return strlen(name) == MEMO_KEY_LEN &&
+	       strspn(name, "0123456789abcdef") == MEMO_KEY_LEN;
+}
+
+/**
+ * store_dir() - find the store, creating it if needed
+ *
+ * Return: the path, or NULL if there is nowhere to put it.
+ */
+static const char *store_dir(void)
+{
+	static _Thread_local char path[PATH_MAX];
+	const char *base;
+
+	base = var_get("MEMO_DIR");
+	if (base && *base) {
+		snprintf(path, sizeof(path), "%s", base);
+	} else {
+		base = var_get("XDG_CACHE_HOME");
+		if (base && *base) {
+			snprintf(path, sizeof(path), "%s", base);
+		} else {
+			base = var_get("HOME");
+			if (!base)
+				return NULL;
+			snprintf(path, sizeof(path), "%s/.cache", base);
+		}
+		mkdir(path, 0700);
+		strncat(path, "/shell-memo", sizeof(path) - strlen(path) - 1);
+	}
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return NULL;
+	return path;
+}
+
+/**
+ * write_outputs() - copy a command's outputs to the builtin's own
+ *
+ * Errors writing standard output are reported when the builtin
+ * returns, as for any builtin output.
+ */
+static void write_outputs(int out_fd, off_t out_offset, uint64_t out_len,
+			  int err_fd, off_t err_offset, uint64_t err_len)
+{
+	bout_copy_fd(out_fd, out_offset, out_len);
+	fd_copy(STDERR_FILENO, err_fd, err_offset, err_len);
+}
+
+/**
+ * replay_entry() - write out a cached result
+ *
+ * Return: the cached exit status, or -1 if the entry is not valid, in
+ * which case nothing was written.
+ */
+static int replay_entry(int fd)
+{
+	struct memo_entry_header hdr;
+	struct stat st;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, MEMO_MAGIC, sizeof(hdr.magic)) ||
+	    fstat(fd, &st) < 0 ||
+	    (uint64_t)st.st_size !=
+		    sizeof(hdr) + hdr.stdout_len + hdr.stderr_len)
+		return -1;
+
+	/* Mark it as recently used, for eviction. */
+	futimens(fd, NULL);
+
+	write_outputs(fd, sizeof(hdr), hdr.stdout_len, fd,
+		      sizeof(hdr) + hdr.stdout_len, hdr.stderr_len);
+	return hdr.status;
+}
+
+struct store_file {
+	char name[MEMO_KEY_LEN + 1];
+	off_t size;
+	struct timespec mtime;
+};
+
+static int compare_mtime(const void *a, const void *b)
+{
+	const struct store_file *fa = a, *fb = b;
+
+	if (fa->mtime.tv_sec != fb->mtime.tv_sec)
+		return fa->mtime.tv_sec < fb->mtime.tv_sec ? -1 : 1;
+	if (fa->mtime.tv_nsec != fb->mtime.tv_nsec)
+		return fa->mtime.tv_nsec < fb->mtime.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+/**
+ * scan_store() - list the entries in the store
+ *
+ * @total:  Output parameter for the size of all the entries.
+ *
+ * Return: a newly allocated array of the entries, with its length in
+ * @n, or NULL if the store could not be read.
+ */
+static struct store_file *scan_store(DIR *dir, size_t *n, uint64_t *total)
+{
+	struct store_file *files = NULL;
+	size_t cap = 0;
+	struct dirent *ent;
+	struct stat st;
+
+	*n = 0;
+	*total = 0;
+	while ((ent = readdir(dir))) {
+		if (!is_entry_name(ent->d_name) ||
+		    fstatat(dirfd(dir), ent->d_name, &st, 0) < 0)
+			continue;
+		if (*n == cap) {
+			cap = cap ? cap * 2 : 64;
+			files = realloc(files, cap * sizeof(*files));
+		}
+		memcpy(files[*n].name, ent->d_name, MEMO_KEY_LEN + 1);
+		files[*n].size = st.st_size;
+		files[*n].mtime = st.st_mtim;
+		*total += st.st_size;
+		(*n)++;
+	}
+	return files;
+}
+
+uint64_t memo_max_size(void)
+{
+	const char *value = var_get("MEMO_MAX_SIZE");
+	unsigned long long size;
+	char *end;
+
+	if (!value || !*value)
+		return MEMO_DEFAULT_MAX_SIZE;
+	size = strtoull(value, &end, 10);
+	switch (*end) {
+	case 'G':
+		size <<= 10;
+		/* fallthrough */
+	case 'M':
+		size <<= 10;
+		/* fallthrough */
+	case 'K':
+		size <<= 10;
+		break;
+	}
+	return size;
+}
+
+/**
+ * evict() - remove the least recently used entries over the size limit
+ */
+static void evict(const char *path)
+{
+	uint64_t max_size = memo_max_size();
+	struct store_file *files;
+	uint64_t total;
+	DIR *dir;
+	size_t n;
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+	files = scan_store(dir, &n, &total);
+	if (total > max_size) {
+		qsort(files, n, sizeof(*files), compare_mtime);
+		for (size_t i = 0; i < n && total > max_size; i++) {
+			if (!unlinkat(dirfd(dir), files[i].name, 0))
+				total -= files[i].size;
+		}
+	}
+	free(files);
+	closedir(dir);
+}
+
+/**
+ * store_entry() - save a command's result in the store
+ *
+ * The entry is written to a temporary file and renamed into place,
+ * so a concurrent "memo" never sees half of one.
+ */
+static void store_entry(const char *dir, const char *path, int status,
+			int out_fd, uint64_t out_len, int err_fd,
+			uint64_t err_len)
+{
+	struct memo_entry_header hdr = {
+		.magic = MEMO_MAGIC,
+		.status = status,
+		.stdout_len = out_len,
+		.stderr_len = err_len,
+	};
+	char tmp[PATH_MAX];
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", dir);
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    fd_copy(fd, out_fd, 0, out_len) < 0 ||
+	    fd_copy(fd, err_fd, 0, err_len) < 0 || rename(tmp, path) < 0)
+		unlink(tmp);
+	close(fd);
+	evict(dir);
+}
+
+/**
+ * run_and_store() - run a command, capturing its outputs, and cache them
+ *
+ * The outputs are captured in memfds, so they need not fit in the
+ * shell's memory, and are copied to the store and the builtin's
+ * output once the command has finished.
+ *
+ * @in_fd:  The command's standard input.
+ * @dir:    The store, or NULL to only run the command.
+ * @path:   The path of the entry in the store.
+ *
+ * Return: the exit status of the command.
+ */
+static int run_and_store(const char *const argv[], char *const envp[],
+			 int in_fd, const char *dir, const char *path)
+{
+	uint64_t out_len, err_len;
+	int out_fd, err_fd;
+	pid_t pid;
+	int rv = 1;
+
+	out_fd = memfd_create("memo-stdout", MFD_CLOEXEC);
+	err_fd = memfd_create("memo-stderr", MFD_CLOEXEC);
+	if (out_fd < 0 || err_fd < 0) {
+		fprintf(stderr, "memo: memfd_create: %s\n", strerror(errno));
+		goto out;
+	}
+
+	pid = spawn_command(argv, envp, in_fd, out_fd, err_fd);
+	if (pid < 0)
+		goto out;
+	rv = wait_command(pid);
+
+	out_len = lseek(out_fd, 0, SEEK_END);
+	err_len = lseek(err_fd, 0, SEEK_END);
+	if (rv >= 0 && dir)
+		store_entry(dir, path, rv, out_fd, out_len, err_fd, err_len);
+	write_outputs(out_fd, 0, out_len, err_fd, 0, err_len);
+
+out:
+	if (out_fd >= 0)
+		close(out_fd);
+	if (err_fd >= 0)
+		close(err_fd);
+	return rv;
+}
+
+/**
+ * capture_input() - copy all of @fd into a memfd
+ *
+ * The input has to be read before the key can be computed, and the
+ * copy is then what the command reads, if it is run.
+ *
+ * Return: the memfd, at its start, or -1 on failure.
+ */
+static int capture_input(int fd)
+{
+	int memfd = memfd_create("memo-stdin", MFD_CLOEXEC);
+	char buf[65536];
+	ssize_t n;
+
+	if (memfd < 0)
+		return -1;
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 || write(memfd, buf, n) != n) {
+			close(memfd);
+			return -1;
+		}
+	}
+	lseek(memfd, 0, SEEK_SET);
+	return memfd;
+}
+
+int memo_run(const char *const argv[], char *const envp[],
+	     const struct memo_inputs *inputs)
+{
+	const char *dir = store_dir();
+	char key[MEMO_KEY_LEN + 1];
+	char path[PATH_MAX];
+	int in_fd = builtin_input_fd;
+	int input_copy = -1;
+	char *exe = NULL;
+	int fd, rv;
+
+	if (!find_builtin(argv[0])) {
+		exe = path_lookup(argv[0]);
+		if (!exe) {
+			fprintf(stderr, "memo: %s: command not found\n",
+				argv[0]);
+			return 127;
+		}
+	}
+
+	/*
+	 * Input which is part of the key has to be read first.  If it
+	 * cannot be copied, the command is run without caching it.
+	 */
+	if (inputs->standard_input) {
+		input_copy = capture_input(in_fd);
+		if (input_copy < 0) {
+			fprintf(stderr, "memo: reading input: %s\n",
+				strerror(errno));
+			dir = NULL;
+		} else {
+			in_fd = input_copy;
+		}
+	}
+
+	compute_key(argv, envp, exe, input_copy, inputs, key);
+	snprintf(path, sizeof(path), "%s/%s", dir ? dir : "", key);
+	free(exe);
+
+	if (dir) {
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			rv = replay_entry(fd);
+			close(fd);
+			if (rv >= 0) {
+				STATS_INC(memo_hits);
+				goto out;
+			}
+		}
+	}
+
+	STATS_INC(memo_misses);
+	rv = run_and_store(argv, envp, in_fd, dir, path);
+out:
+	if (input_copy >= 0)
+		close(input_copy);
+	return rv;
+}
+
+const char *memo_usage(uint64_t *entries, uint64_t *bytes)
+{
+	const char *path = store_dir();
+	struct store_file *files;
+	DIR *dir;
+	size_t n;
+
+	*entries = 0;
+	*bytes = 0;
+	if (!path)
+		return NULL;
+	dir = opendir(path);
+	if (!dir)
+		return NULL;
+
+	files = scan_store(dir, &n, bytes);
+	*entries = n;
+	free(files);
+	closedir(dir);
+	return path;
+}
+
+int memo_clear(void)
+{
+	const char *path = store_dir();
+	struct dirent *ent;
+	DIR *dir;
+	int rv = 0;
+
+	if (!path)
+		return 0;
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((ent = readdir(dir))) {
+		if (!is_entry_name(ent->d_name) &&
+		    strncmp(ent->d_name, ".tmp-", 5))
+			continue;
+		if (unlinkat(dirfd(dir), ent->d_name, 0) < 0)
+			rv = -1;
+	}
+	closedir(dir);
+	return rv;
+}
@@ -0,0 +1,19 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "options.h"
+
+bool shell_options[SHELL_OPTION_COUNT];
+
+const char *shell_option_names[SHELL_OPTION_COUNT] = {
+	[SHELL_OPTION_PASTE_ERREXIT] = "paste-errexit",
+};
+
+int shell_option_lookup(const char *name)
+{
+	for (int i = 0; i < SHELL_OPTION_COUNT; i++) {
+		if (!strcmp(shell_option_names[i], name))
+			return i;
+	}
+	return -1;
+}
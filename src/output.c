@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+
+#define BOUT_BUFFER_SIZE (64 * 1024)
+
+/* Each thread running a builtin has its own buffer. */
+static _Thread_local struct {
+	char data[BOUT_BUFFER_SIZE];
+	size_t len;
+	int fd;
+
+	/* The errno of the first failed write since the last flush. */
+	int error;
+} bout = { .fd = STDOUT_FILENO };
+
+/**
+ * write_iov() - write an iovec array in full
+ *
+ * Return: zero on success, or -1 on error.
+ */
+static int write_iov(struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while (iovcnt) {
+		n = writev(bout.fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (iovcnt && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * flush_with() - write the buffer, followed by @data
+ */
+static void flush_with(const char *data, size_t len)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = bout.data, .iov_len = bout.len },
+		{ .iov_base = (void *)data, .iov_len = len },
+	};
+
+	if (!bout.error && write_iov(iov, len ? 2 : 1) < 0)
+		bout.error = errno;
+	bout.len = 0;
+}
+
+void bout_write(const char *data, size_t len)
+{
+	if (len <= sizeof(bout.data) - bout.len) {
+		memcpy(bout.data + bout.len, data, len);
+		bout.len += len;
+		return;
+	}
+
+	/* Too large to buffer: write it straight after the buffer. */
+	flush_with(data, len);
+}
+
+void bout_puts(const char *str)
+{
+	bout_write(str, strlen(str));
+}
+
+void bout_printf(const char *fmt, ...)
+{
+	size_t avail = sizeof(bout.data) - bout.len;
+	va_list ap;
+	char *big;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(bout.data + bout.len, avail, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if ((size_t)n < avail) {
+		bout.len += n;
+		return;
+	}
+
+	/* It didn't fit.  Format it separately and write that. */
+	big = malloc(n + 1);
+	va_start(ap, fmt);
+	vsnprintf(big, n + 1, fmt, ap);
+	va_end(ap);
+	bout_write(big, n);
+	free(big);
+}
+
+int fd_copy(int out_fd, int in_fd, off_t offset, uint64_t len)
+{
+	char buf[65536];
+	ssize_t n;
+
+	while (len) {
+		n = sendfile(out_fd, in_fd, &offset, len);
+		if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+			n = pread(in_fd, buf,
+				  len < sizeof(buf) ? len : sizeof(buf),
+				  offset);
+			if (n > 0)
+				n = write(out_fd, buf, n);
+			if (n > 0)
+				offset += n;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (!n)
+				errno = EIO;
+			return -1;
+		}
+		len -= n;
+	}
+	return 0;
+}
+
+void bout_copy_fd(int fd, off_t offset, uint64_t len)
+{
+	if (bout.len)
+		flush_with(NULL, 0);
+	if (!bout.error && fd_copy(bout.fd, fd, offset, len) < 0)
+		bout.error = errno;
+}
+
+int bout_flush(void)
+{
+	if (bout.len)
+		flush_with(NULL, 0);
+	if (bout.error) {
+		errno = bout.error;
+		bout.error = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void bout_set_fd(int fd)
+{
+	bout_flush();
+	bout.fd = fd;
+}
+
+int bout_fd(void)
+{
+	return bout.fd;
+}
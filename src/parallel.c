@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/pidfd.h>
+#include <unistd.h>
+
+#include "dispatcher.h"
+#include "output.h"
+#include "parallel.h"
+#include "shell_builtins.h"
+#include "variables.h"
+
+/*
+ * How many jobs, per concurrent job, may have finished and be waiting
+ * for an earlier one before their output is written.
+ */
+#define PARALLEL_WINDOW 4
+
+struct job {
+	/* The child, or 0 if it has been reaped or never started. */
+	pid_t pid;
+	/* A pidfd for the child, or -1 if pidfds are not available. */
+	int pidfd;
+	int out_fd;
+	int err_fd;
+	int status;
+};
+
+struct pool {
+	const struct parallel_options *opts;
+	char *const *envp;
+	int null_fd;
+
+	/* The items, or the input to read them from. */
+	const char *const *items;
+	FILE *input;
+
+	/*
+	 * Jobs are numbered in item order.  Those from next_print up
+	 * to next_start are running, or have finished and are waiting
+	 * for their output to be written, in ring[number % ring_size].
+	 */
+	struct job *ring;
+	size_t ring_size;
+	size_t next_start;
+	size_t next_print;
+	size_t running;
+
+	size_t failed;
+	bool halting;
+	int halt_rv;
+};
+
+/**
+ * next_item() - get the next item to run a job for
+ *
+ * Return: the newly allocated item, or NULL if there are no more.
+ */
+static char *next_item(struct pool *pool)
+{
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	if (!pool->input)
+		return *pool->items ? strdup(*pool->items++) : NULL;
+
+	len = getline(&line, &cap, pool->input);
+	if (len < 0) {
+		free(line);
+		return NULL;
+	}
+	if (len && line[len - 1] == '\n')
+		line[len - 1] = '\0';
+	return line;
+}
+
+/**
+ * replace_braces() - replace every "{}" in @arg with @item
+ *
+ * Return: the newly allocated result.
+ */
+static char *replace_braces(const char *arg, const char *item)
+{
+	size_t item_len = strlen(item);
+	size_t n = 0;
+	const char *p;
+	char *out, *q;
+
+	for (p = strstr(arg, "{}"); p; p = strstr(p + 2, "{}"))
+		n++;
+	out = malloc(strlen(arg) + n * item_len + 1);
+
+	for (q = out; (p = strstr(arg, "{}")); arg = p + 2) {
+		memcpy(q, arg, p - arg);
+		q += p - arg;
+		memcpy(q, item, item_len);
+		q += item_len;
+	}
+	strcpy(q, arg);
+	return out;
+}
+
+/**
+ * expand_template() - build the command line for one item
+ *
+ * Return: a newly allocated, NULL-terminated array of newly
+ * allocated arguments.
+ */
+static char **expand_template(const char *const template[],
+			      const char *item)
+{
+	bool has_braces = false;
+	size_t argc = 0;
+	char **argv;
+
+	for (; template[argc]; argc++) {
+		if (strstr(template[argc], "{}"))
+			has_braces = true;
+	}
+	argv = calloc(argc + 2, sizeof(*argv));
+	for (size_t i = 0; i < argc; i++)
+		argv[i] = replace_braces(template[i], item);
+	if (!has_braces)
+		argv[argc] = strdup(item);
+	return argv;
+}
+
+static void free_argv(char **argv)
+{
+	for (char **p = argv; *p; p++)
+		free(*p);
+	free(argv);
+}
+
+static void start_job(struct pool *pool, const char *const template[],
+		      const char *item)
+{
+	struct job *job = &pool->ring[pool->next_start++ % pool->ring_size];
+	char **argv = expand_template(template, item);
+
+	job->pid = 0;
+	job->pidfd = -1;
+	job->status = 1;
+	job->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+	job->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+	if (job->out_fd < 0 || job->err_fd < 0) {
+		fprintf(stderr, "parallel: memfd_create: %s\n",
+			strerror(errno));
+	} else {
+		job->pid = spawn_command((const char *const *)argv, pool->envp,
+					 pool->null_fd, job->out_fd,
+					 job->err_fd);
+		if (job->pid < 0)
+			job->pid = 0;
+	}
+	free_argv(argv);
+
+	if (!job->pid) {
+		pool->failed++;
+		return;
+	}
+	job->pidfd = pidfd_open(job->pid, 0);
+	pool->running++;
+}
+
+/**
+ * finish_job() - reap a job which has exited, and apply the halt policy
+ */
+static void finish_job(struct pool *pool, struct job *job)
+{
+	job->status = wait_command(job->pid);
+	job->pid = 0;
+	if (job->pidfd >= 0)
+		close(job->pidfd);
+	job->pidfd = -1;
+	pool->running--;
+
+	if (!job->status)
+		return;
+	pool->failed++;
+	if (pool->opts->halt == PARALLEL_HALT_NEVER || pool->halting)
+		return;
+
+	pool->halting = true;
+	pool->halt_rv = job->status;
+	if (pool->opts->halt != PARALLEL_HALT_NOW)
+		return;
+	for (size_t i = pool->next_print; i < pool->next_start; i++) {
+		job = &pool->ring[i % pool->ring_size];
+		if (job->pid)
+			kill(job->pid, SIGTERM);
+	}
+}
+
+/**
+ * wait_any() - wait for at least one running job to exit, and reap it
+ *
+ * The jobs' pidfds are polled, so only this builtin's own children
+ * are waited for, even when other commands in the pipeline are
+ * running too.  Without pidfds, this waits for the oldest job.
+ */
+static void wait_any(struct pool *pool)
+{
+	struct pollfd *fds = calloc(pool->running, sizeof(*fds));
+	struct job **jobs = calloc(pool->running, sizeof(*jobs));
+	struct job *job;
+	size_t n = 0;
+
+	for (size_t i = pool->next_print; i < pool->next_start; i++) {
+		job = &pool->ring[i % pool->ring_size];
+		if (!job->pid)
+			continue;
+		if (job->pidfd < 0) {
+			finish_job(pool, job);
+			goto out;
+		}
+		fds[n].fd = job->pidfd;
+		fds[n].events = POLLIN;
+		jobs[n++] = job;
+	}
+
+	while (poll(fds, n, -1) < 0) {
+		if (errno != EINTR) {
+			perror("parallel: poll");
+			goto out;
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (fds[i].revents)
+			finish_job(pool, jobs[i]);
+	}
+
+out:
+	free(fds);
+	free(jobs);
+}
+
+/**
+ * print_finished() - write out finished jobs' output, in item order
+ */
+static void print_finished(struct pool *pool)
+{
+	struct job *job;
+
+	while (pool->next_print < pool->next_start) {
+		job = &pool->ring[pool->next_print % pool->ring_size];
+		if (job->pid)
+			break;
+
+		if (job->out_fd >= 0) {
+			bout_copy_fd(job->out_fd, 0,
+				     lseek(job->out_fd, 0, SEEK_END));
+			close(job->out_fd);
+		}
+		if (job->err_fd >= 0) {
+			fd_copy(STDERR_FILENO, job->err_fd, 0,
+				lseek(job->err_fd, 0, SEEK_END));
+			close(job->err_fd);
+		}
+		pool->next_print++;
+	}
+}
+
+int parallel_run(const char *const template[], const char *const items[],
+		 const struct parallel_options *opts)
+{
+	struct pool pool = {
+		.opts = opts,
+		.envp = builtin_envp ? builtin_envp : var_envp(),
+		.items = items,
+	};
+	char *item;
+
+	if (!opts->max_jobs ||
+	    __builtin_mul_overflow(opts->max_jobs, PARALLEL_WINDOW,
+				   &pool.ring_size)) {
+		fprintf(stderr, "parallel: too many jobs\n");
+		return 1;
+	}
+	pool.ring = calloc(pool.ring_size, sizeof(*pool.ring));
+	if (!pool.ring) {
+		perror("parallel");
+		return 1;
+	}
+
+	if (!items) {
+		pool.input = fdopen(dup(builtin_input_fd), "r");
+		if (!pool.input) {
+			perror("parallel");
+			free(pool.ring);
+			return 1;
+		}
+	}
+	pool.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	for (;;) {
+		while (!pool.halting && pool.running < opts->max_jobs &&
+		       pool.next_start - pool.next_print < pool.ring_size &&
+		       (item = next_item(&pool))) {
+			start_job(&pool, template, item);
+			free(item);
+		}
+		print_finished(&pool);
+		if (!pool.running)
+			break;
+		wait_any(&pool);
+	}
+	print_finished(&pool);
+
+	free(pool.ring);
+	if (pool.null_fd >= 0)
+		close(pool.null_fd);
+	if (pool.input)
+		fclose(pool.input);
+
+	if (pool.halting)
+		return pool.halt_rv;
+	return pool.failed > 101 ? 101 : pool.failed;
+}
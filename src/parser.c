@@ -3,35 +3,33 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "parser.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
 
 #define WHITESPACE_DELIMS " \f\n\r\t\v"
-#define ALL_DELIMS WHITESPACE_DELIMS "<>|"
+#define ALL_DELIMS WHITESPACE_DELIMS "<>|&"
 
 const char *parse_error_str[] = {
 	[PARSE_SUCCESS] = "Success",
 	[PARSE_ERR_COMMAND_WITHOUT_ARGS] = "Command has no arguments",
-	[PARSE_ERR_MULTIPLE_INPUTS] = "Command has multiple inputs",
-	[PARSE_ERR_MULTIPLE_OUTPUTS] = "Command has multiple outputs",
 	[PARSE_ERR_MISSING_ARG_TO_FILE_OP] = "Missing operand to file operator",
 	[PARSE_ERR_TOO_MANY_ARGS] =
 	"The number of command line arguments is not supported by this shell",
+	[PARSE_ERR_UNTERMINATED_QUOTE] = "Unterminated quote",
+	[PARSE_ERR_BAD_FD_REDIRECTION] =
+	"Redirection to a file descriptor needs a number or \"-\"",
+	[PARSE_ERR_MISPLACED_AMPERSAND] =
+	"\"&\" is only supported at the end of a command",
 };
 
-static char *sized_strdup(const char *base, size_t len)
-{
-	char *buf;
-
-	buf = malloc(len + 1);
-	memcpy(buf, base, len);
-	buf[len] = '\0';
-	return buf;
-}
-
 static size_t consume_delims(const char **input, const char *delims)
 {
 	size_t n_delims = strspn(*input, delims);
@@ -54,102 +52,235 @@ static bool consume_string(const char **input, const char *search)
 	return false;
 }
 
-static char *consume_word(const char **input)
+/**
+ * consume_word() - consume a word, removing any quoting
+ *
+ * Within single quotes, every character is literal.  Within double
+ * quotes, a backslash only escapes one of $, `, ", \ or newline.
+ * Elsewhere, a backslash escapes any character.  Quoted delimiters do
+ * not end the word.
+ *
+ * @input:  The input, which is advanced past the word.
+ * @err:    Set to PARSE_ERR_UNTERMINATED_QUOTE if a quote is not
+ *          closed.
+ *
+ * Return: the newly allocated word, or NULL if there is none.
+ */
+static char *consume_word(const char **input, enum parse_error *err)
 {
+	const char *p;
+	char quote = '\0';
 	char *result;
-	size_t word_len;
+	char *out;
 
 	consume_delims(input, WHITESPACE_DELIMS);
-	word_len = strcspn(*input, ALL_DELIMS);
-	if (!word_len)
+	result = malloc(strlen(*input) + 1);
+	out = result;
+
+	for (p = *input; *p; p++) {
+		if (quote == '\'') {
+			if (*p == '\'')
+				quote = '\0';
+			else
+				*out++ = *p;
+		} else if (*p == '\\' && p[1] &&
+			   (!quote || strchr("$`\"\\\n", p[1]))) {
+			*out++ = *++p;
+		} else if (quote == '"') {
+			if (*p == '"')
+				quote = '\0';
+			else
+				*out++ = *p;
+		} else if (*p == '\'' || *p == '"') {
+			quote = *p;
+		} else if (strchr(ALL_DELIMS, *p)) {
+			break;
+		} else {
+			*out++ = *p;
+		}
+	}
+
+	if (quote) {
+		*err = PARSE_ERR_UNTERMINATED_QUOTE;
+		free(result);
 		return NULL;
+	}
+	if (p == *input) {
+		free(result);
+		return NULL;
+	}
 
-	result = sized_strdup(*input, word_len);
-	*input += word_len;
+	*out = '\0';
+	*input = p;
 	return result;
 }
 
-enum parse_error parse_input(const char *input, struct command **pipeline_out)
+/*
+ * Whether @word is a variable assignment: a name made of letters,
+ * digits and underscores, not starting with a digit, then an "=".
+ */
+static bool is_assignment(const char *word)
+{
+	size_t name_len = strspn(word, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+				       "abcdefghijklmnopqrstuvwxyz"
+				       "0123456789_");
+
+	return name_len && word[name_len] == '=' &&
+	       !(word[0] >= '0' && word[0] <= '9');
+}
+
+static void add_redirection(struct command *cmd, struct redirection r)
+{
+	cmd->redirections = realloc(cmd->redirections,
+				    (cmd->n_redirections + 1) *
+					    sizeof(*cmd->redirections));
+	cmd->redirections[cmd->n_redirections++] = r;
+}
+
+/**
+ * consume_redirection() - parse a redirection, if @input starts with one
+ *
+ * The redirection is added to cmd->redirections, after any before it.
+ *
+ * @matched:    Set to whether there was a redirection.
+ *
+ * Return: PARSE_SUCCESS, or the parse error.
+ */
+static enum parse_error consume_redirection(const char **input,
+					    struct command *cmd,
+					    bool *matched)
+{
+	const char *p = *input + strspn(*input, WHITESPACE_DELIMS);
+	size_t digits = strspn(p, "0123456789");
+	enum parse_error err = PARSE_SUCCESS;
+	struct redirection r = { 0 };
+	char *word;
+
+	*matched = false;
+	if (digits > 4 || (p[digits] != '<' && p[digits] != '>'))
+		return PARSE_SUCCESS;
+	*matched = true;
+	r.fd = digits ? atoi(p) : p[0] == '<' ? STDIN_FILENO : STDOUT_FILENO;
+	p += digits;
+
+	if (p[1] == '&') {
+		r.type = REDIRECTION_DUP;
+		p += 2;
+	} else if (p[0] == '>' && p[1] == '>') {
+		r.type = REDIRECTION_APPEND;
+		p += 2;
+	} else {
+		r.type = p[0] == '<' ? REDIRECTION_INPUT :
+				       REDIRECTION_TRUNCATE;
+		p++;
+	}
+
+	word = consume_word(&p, &err);
+	*input = p;
+	if (!word)
+		return err ?: PARSE_ERR_MISSING_ARG_TO_FILE_OP;
+
+	if (r.type == REDIRECTION_DUP) {
+		digits = strspn(word, "0123456789");
+		if (!strcmp(word, "-")) {
+			r.type = REDIRECTION_CLOSE;
+		} else if (digits && digits <= 4 && !word[digits]) {
+			r.source_fd = atoi(word);
+		} else {
+			free(word);
+			return PARSE_ERR_BAD_FD_REDIRECTION;
+		}
+		free(word);
+	} else {
+		r.filename = word;
+	}
+	add_redirection(cmd, r);
+	return PARSE_SUCCESS;
+}
+
+static void free_redirections(struct command *cmd)
 {
+	for (size_t i = 0; i < cmd->n_redirections; i++)
+		free(cmd->redirections[i].filename);
+	free(cmd->redirections);
+}
+
+/**
+ * parse_pipeline() - parse a command, and the rest of its pipeline
+ */
+static enum parse_error parse_pipeline(const char *input,
+				       struct command **pipeline_out)
+{
+	bool matched;
 	struct command cmd;
 	enum parse_error rv = PARSE_SUCCESS;
 	size_t args = 0;
+	size_t n_assignments = 0;
+	enum parse_error word_err = PARSE_SUCCESS;
+	char *word;
 
 	*pipeline_out = NULL;
 	memset(&cmd, 0, sizeof(cmd));
 	for (;;) {
-		if (consume_string(&input, ">>")) {
-			if (cmd.output_type) {
-				rv = PARSE_ERR_MULTIPLE_OUTPUTS;
-				goto fail;
-			}
-			cmd.output_filename = consume_word(&input);
-			if (!cmd.output_filename) {
-				rv = PARSE_ERR_MISSING_ARG_TO_FILE_OP;
-				goto fail;
-			}
-			cmd.output_type = COMMAND_OUTPUT_FILE_APPEND;
-			continue;
-		} else if (consume_string(&input, ">")) {
-			if (cmd.output_type) {
-				rv = PARSE_ERR_MULTIPLE_OUTPUTS;
-				goto fail;
-			}
-			cmd.output_filename = consume_word(&input);
-			if (!cmd.output_filename) {
-				rv = PARSE_ERR_MISSING_ARG_TO_FILE_OP;
-				goto fail;
-			}
-			cmd.output_type = COMMAND_OUTPUT_FILE_TRUNCATE;
+		rv = consume_redirection(&input, &cmd, &matched);
+		if (rv)
+			goto fail;
+		if (matched)
 			continue;
-		} else if (consume_string(&input, "<")) {
-			if (cmd.input_filename) {
-				rv = PARSE_ERR_MULTIPLE_INPUTS;
-				goto fail;
-			}
 
-			cmd.input_filename = consume_word(&input);
-			if (!cmd.input_filename) {
-				rv = PARSE_ERR_MISSING_ARG_TO_FILE_OP;
-				goto fail;
-			}
-			continue;
-		} else if (consume_string(&input, "|")) {
-			if (cmd.output_type) {
-				rv = PARSE_ERR_MULTIPLE_OUTPUTS;
+		if (consume_string(&input, "&")) {
+			consume_delims(&input, WHITESPACE_DELIMS);
+			if (*input) {
+				rv = PARSE_ERR_MISPLACED_AMPERSAND;
 				goto fail;
 			}
+			cmd.background = true;
+			break;
+		}
 
-			rv = parse_input(input, &cmd.pipe_to);
+		if (consume_string(&input, "|")) {
+			rv = parse_pipeline(input, &cmd.pipe_to);
 			if (rv)
 				goto fail;
 			if (!cmd.pipe_to) {
 				rv = PARSE_ERR_COMMAND_WITHOUT_ARGS;
 				goto fail;
 			}
-			if (cmd.pipe_to->input_filename) {
-				free_parse_result(cmd.pipe_to);
-				cmd.pipe_to = NULL;
-				rv = PARSE_ERR_MULTIPLE_INPUTS;
+			cmd.output_type = COMMAND_OUTPUT_PIPE;
+			cmd.background = cmd.pipe_to->background;
+			break;
+		}
+
+		word = consume_word(&input, &word_err);
+		if (!word) {
+			if (word_err) {
+				rv = word_err;
 				goto fail;
 			}
-			cmd.output_type = COMMAND_OUTPUT_PIPE;
 			break;
 		}
 
+		if (!args && is_assignment(word)) {
+			if (n_assignments >= ARGS_MAX - 1) {
+				free(word);
+				rv = PARSE_ERR_TOO_MANY_ARGS;
+				goto fail;
+			}
+			cmd.assignments[n_assignments++] = word;
+			continue;
+		}
+
 		if (args >= ARGS_MAX - 1) {
+			free(word);
 			rv = PARSE_ERR_TOO_MANY_ARGS;
 			goto fail;
 		}
-
-		cmd.argv[args] = consume_word(&input);
-		if (!cmd.argv[args])
-			break;
-		args++;
+		cmd.argv[args++] = word;
 	}
 
 	if (!args) {
-		if (cmd.input_filename || cmd.output_type) {
+		if (cmd.output_type || n_assignments || cmd.n_redirections ||
+		    cmd.background) {
 			rv = PARSE_ERR_COMMAND_WITHOUT_ARGS;
 			goto fail;
 		}
@@ -161,10 +292,26 @@ enum parse_error parse_input(const char *input, struct command **pipeline_out)
 	return PARSE_SUCCESS;
 
 fail:
-	free(cmd.input_filename);
-	free(cmd.output_filename);
+	if (cmd.output_type == COMMAND_OUTPUT_PIPE)
+		free_parse_result(cmd.pipe_to);
 	for (size_t i = 0; i < args; i++)
 		free(cmd.argv[i]);
+	for (size_t i = 0; i < n_assignments; i++)
+		free(cmd.assignments[i]);
+	free_redirections(&cmd);
+	return rv;
+}
+
+enum parse_error parse_input(const char *input, struct command **pipeline_out)
+{
+	uint64_t start = stats_now_ns();
+	enum parse_error rv;
+
+	PROBE1(parse_start, input);
+	rv = parse_pipeline(input, pipeline_out);
+	PROBE2(parse_end, input, rv);
+	stats_hist_add(stats_self()->parse_hist, stats_now_ns() - start);
+	trace_span("parse", start, input, "error", rv);
 	return rv;
 }
 
@@ -173,11 +320,11 @@ void free_parse_result(struct command *parse_result)
 	if (parse_result) {
 		for (char **p = parse_result->argv; *p; p++)
 			free(*p);
-		free(parse_result->input_filename);
+		for (char **p = parse_result->assignments; *p; p++)
+			free(*p);
+		free_redirections(parse_result);
 		if (parse_result->output_type == COMMAND_OUTPUT_PIPE)
 			free_parse_result(parse_result->pipe_to);
-		else
-			free(parse_result->output_filename);
 		free(parse_result);
 	}
 }
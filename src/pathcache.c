@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pathcache.h"
+#include "stats.h"
+#include "strhash.h"
+#include "variables.h"
+
+#define PATH_CACHE_BUCKETS 256
+
+/* The default search path, when PATH is unset. */
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+struct path_entry {
+	struct path_entry *next;
+	char *name;
+	char *path;
+};
+
+/* Builtins in a pipeline may look up commands from other threads. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct path_entry *buckets[PATH_CACHE_BUCKETS];
+
+/* The PATH the cached entries were found in. */
+static char *cached_path_var;
+
+static void clear_locked(void)
+{
+	struct path_entry *entry, *next;
+
+	for (size_t i = 0; i < PATH_CACHE_BUCKETS; i++) {
+		for (entry = buckets[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+		}
+		buckets[i] = NULL;
+	}
+	free(cached_path_var);
+	cached_path_var = NULL;
+}
+
+void path_cache_clear(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	clear_locked();
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static bool is_executable(const char *path)
+{
+	struct stat st;
+
+	return !stat(path, &st) && S_ISREG(st.st_mode) &&
+	       !access(path, X_OK);
+}
+
+/**
+ * search_path() - search @path_var for executables called @name
+ *
+ * @all:    Find every match, rather than stopping at the first.
+ * @n:      Output parameter for the number of matches.
+ *
+ * Return: a newly allocated, NULL-terminated array of matches.
+ */
+static char **search_path(const char *path_var, const char *name, bool all,
+			  size_t *n)
+{
+	size_t name_len = strlen(name);
+	const char *dir = path_var;
+	char **matches = NULL;
+	size_t dir_len;
+	char *path;
+
+	*n = 0;
+	for (;;) {
+		dir_len = strcspn(dir, ":");
+		path = malloc(dir_len + name_len + 3);
+		if (dir_len) {
+			memcpy(path, dir, dir_len);
+			path[dir_len] = '/';
+			memcpy(path + dir_len + 1, name, name_len + 1);
+		} else {
+			/* An empty entry is the current directory. */
+			sprintf(path, "./%s", name);
+		}
+
+		if (is_executable(path)) {
+			matches = realloc(matches,
+					  (*n + 2) * sizeof(*matches));
+			matches[(*n)++] = path;
+			if (!all)
+				break;
+		} else {
+			free(path);
+		}
+
+		if (!dir[dir_len])
+			break;
+		dir += dir_len + 1;
+	}
+
+	if (!matches)
+		matches = malloc(sizeof(*matches));
+	matches[*n] = NULL;
+	return matches;
+}
+
+/*
+ * Empty the cache if PATH has changed, and return the PATH to search.
+ * The cache lock must be held.
+ */
+static const char *check_path_var(void)
+{
+	const char *path_var = var_get("PATH");
+
+	if (!path_var)
+		path_var = DEFAULT_PATH;
+	if (!cached_path_var || strcmp(cached_path_var, path_var)) {
+		clear_locked();
+		cached_path_var = strdup(path_var);
+	}
+	return cached_path_var;
+}
+
+static struct path_entry **find_entry(const char *name)
+{
+	struct path_entry **link;
+
+	link = &buckets[strhash(name, 0) % PATH_CACHE_BUCKETS];
+	for (; *link; link = &(*link)->next) {
+		if (!strcmp((*link)->name, name))
+			break;
+	}
+	return link;
+}
+
+static void add_entry(const char *name, const char *path)
+{
+	struct path_entry **link = find_entry(name);
+	struct path_entry *entry = *link;
+
+	if (!entry) {
+		entry = calloc(1, sizeof(*entry));
+		entry->name = strdup(name);
+		*link = entry;
+	}
+	free(entry->path);
+	entry->path = strdup(path);
+}
+
+char *path_lookup(const char *name)
+{
+	struct path_entry **link;
+	struct path_entry *entry;
+	const char *path_var;
+	char *path = NULL;
+	char **matches;
+	size_t n;
+
+	if (strchr(name, '/'))
+		return strdup(name);
+
+	pthread_mutex_lock(&cache_lock);
+	path_var = check_path_var();
+	link = find_entry(name);
+	entry = *link;
+	if (entry) {
+		if (!access(entry->path, X_OK)) {
+			STATS_INC(path_cache_hits);
+			path = strdup(entry->path);
+			goto out;
+		}
+
+		/* It has moved or gone.  Search again. */
+		*link = entry->next;
+		free(entry->name);
+		free(entry->path);
+		free(entry);
+	}
+
+	STATS_INC(path_cache_misses);
+	matches = search_path(path_var, name, false, &n);
+	path = matches[0];
+	free(matches);
+	if (path)
+		add_entry(name, path);
+
+out:
+	pthread_mutex_unlock(&cache_lock);
+	return path;
+}
+
+char **path_lookup_all(const char *name)
+{
+	char **matches;
+	size_t n;
+
+	if (strchr(name, '/')) {
+		matches = calloc(2, sizeof(*matches));
+		if (is_executable(name))
+			matches[0] = strdup(name);
+		return matches;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	matches = search_path(check_path_var(), name, true, &n);
+	if (n)
+		add_entry(name, matches[0]);
+	pthread_mutex_unlock(&cache_lock);
+	return matches;
+}
@@ -0,0 +1,364 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "options.h"
+#include "parser.h"
+#include "rcfile.h"
+#include "script.h"
+#include "variables.h"
+
+#define RC_FILE_NAME ".shellrc"
+#define SNAPSHOT_FILE_NAME ".shellrc.snap"
+#define SNAPSHOT_MAGIC "SHRCSNAP"
+#define SNAPSHOT_VERSION 1
+
+/*
+ * The snapshot is this header, followed by a sequence of records.
+ * Each record is a "struct snapshot_record" followed by "len" bytes
+ * of data.  Unknown record types are skipped.
+ */
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+
+	/* The rc file this snapshot was made from. */
+	int64_t rc_mtime_sec;
+	int64_t rc_mtime_nsec;
+	uint64_t rc_size;
+	uint64_t rc_ino;
+};
+
+enum snapshot_record_type {
+	/* Data: the option name, a NUL, and a 0 or 1 byte. */
+	SNAPSHOT_RECORD_OPTION = 1,
+
+	/*
+	 * Data: the variable name, a NUL, the value, a NUL, and a 0 or
+	 * 1 byte for whether it is exported.
+	 */
+	SNAPSHOT_RECORD_VARIABLE = 2,
+
+	/* Data: the name of a variable which was unset. */
+	SNAPSHOT_RECORD_UNSET = 3,
+};
+
+struct snapshot_record {
+	uint32_t type;
+	uint32_t len;
+};
+
+/* Whether every line run so far is replaceable by a snapshot. */
+static bool rc_cacheable;
+
+static int (*rc_dispatcher)(const char *line, int last_rv,
+			    bool *shell_should_exit);
+
+/*
+ * The variable changes made by the rc file, in order, as snapshot
+ * records.  Unlike options, variables are replayed as changes, since
+ * the environment they apply to differs between shells.
+ */
+static char *var_journal;
+static size_t var_journal_len;
+
+static void journal_var_change(const char *name, const char *value,
+			       bool exported)
+{
+	size_t name_len = strlen(name) + 1;
+	size_t value_len = value ? strlen(value) + 1 : 0;
+	struct snapshot_record rec = {
+		.type = value ? SNAPSHOT_RECORD_VARIABLE :
+				SNAPSHOT_RECORD_UNSET,
+		.len = name_len + (value ? value_len + 1 : 0),
+	};
+	char *p;
+
+	var_journal = realloc(var_journal,
+			      var_journal_len + sizeof(rec) + rec.len);
+	p = var_journal + var_journal_len;
+	memcpy(p, &rec, sizeof(rec));
+	p += sizeof(rec);
+	memcpy(p, name, name_len);
+	if (value) {
+		memcpy(p + name_len, value, value_len);
+		p[name_len + value_len] = exported;
+	}
+	var_journal_len += sizeof(rec) + rec.len;
+}
+
+static char *home_path(const char *name)
+{
+	const char *home = var_get("HOME");
+	char *path;
+
+	if (!home)
+		return NULL;
+	path = malloc(strlen(home) + strlen(name) + 2);
+	sprintf(path, "%s/%s", home, name);
+	return path;
+}
+
+/**
+ * only_sets_state() - check whether a command only changes shell state
+ *
+ * These are the commands a snapshot can replace: "set -o/+o NAME...",
+ * "export NAME[=value]..." and "unset NAME...".  Without names, set
+ * and export list the state instead, and the snapshot would lose that
+ * output.
+ */
+static bool only_sets_state(char *const argv[])
+{
+	size_t i = 1;
+
+	if (!strcmp(argv[0], "set"))
+		return argv[1] && argv[2];
+	if (!strcmp(argv[0], "export")) {
+		while (argv[i] && argv[i][0] == '-')
+			i++;
+		return argv[i];
+	}
+	return !strcmp(argv[0], "unset");
+}
+
+static bool line_is_cacheable(const char *line)
+{
+	struct command *cmd;
+	bool cacheable;
+
+	if (parse_input(line, &cmd))
+		return false;
+	if (!cmd)
+		return true;
+
+	cacheable = cmd->output_type == COMMAND_OUTPUT_STDOUT &&
+		    !cmd->n_redirections && !cmd->background &&
+		    only_sets_state(cmd->argv);
+	free_parse_result(cmd);
+	return cacheable;
+}
+
+static int rc_dispatch(const char *line, int last_rv, bool *shell_should_exit)
+{
+	int rv;
+
+	if (rc_cacheable && !line_is_cacheable(line))
+		rc_cacheable = false;
+	rv = rc_dispatcher(line, last_rv, shell_should_exit);
+	/* A failed line may fail differently next time. */
+	if (rv)
+		rc_cacheable = false;
+	return rv;
+}
+
+static bool header_matches(const struct snapshot_header *hdr,
+			   const struct stat *rc_st)
+{
+	return !memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) &&
+	       hdr->version == SNAPSHOT_VERSION &&
+	       hdr->rc_mtime_sec == rc_st->st_mtim.tv_sec &&
+	       hdr->rc_mtime_nsec == rc_st->st_mtim.tv_nsec &&
+	       hdr->rc_size == (uint64_t)rc_st->st_size &&
+	       hdr->rc_ino == (uint64_t)rc_st->st_ino;
+}
+
+static void apply_option_record(const char *data, uint32_t len)
+{
+	const char *nul = memchr(data, '\0', len);
+	int opt;
+
+	if (!nul || nul + 2 != data + len)
+		return;
+	opt = shell_option_lookup(data);
+	if (opt >= 0)
+		shell_options[opt] = nul[1];
+}
+
+static void apply_variable_record(const char *data, uint32_t len)
+{
+	const char *name_end = memchr(data, '\0', len);
+	const char *value_end;
+
+	if (!name_end)
+		return;
+	value_end = memchr(name_end + 1, '\0', data + len - name_end - 1);
+	if (!value_end || value_end + 2 != data + len)
+		return;
+	var_set(data, name_end + 1, value_end[1] ? VAR_EXPORT : 0);
+	if (!value_end[1])
+		var_export(data, false);
+}
+
+static void apply_unset_record(const char *data, uint32_t len)
+{
+	char *name = strndup(data, len);
+
+	var_unset(name);
+	free(name);
+}
+
+/**
+ * load_snapshot() - apply the snapshot, if it is current
+ *
+ * Return: true if the snapshot was applied.
+ */
+static bool load_snapshot(const char *path, const struct stat *rc_st)
+{
+	struct snapshot_header hdr;
+	struct snapshot_record rec;
+	struct stat st;
+	const char *map;
+	size_t off;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(hdr)) {
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if (!header_matches(&hdr, rc_st)) {
+		munmap((void *)map, st.st_size);
+		return false;
+	}
+
+	for (off = sizeof(hdr); off + sizeof(rec) <= (size_t)st.st_size;
+	     off += sizeof(rec) + rec.len) {
+		memcpy(&rec, map + off, sizeof(rec));
+		if (rec.len > st.st_size - off - sizeof(rec))
+			break;
+		switch (rec.type) {
+		case SNAPSHOT_RECORD_OPTION:
+			apply_option_record(map + off + sizeof(rec), rec.len);
+			break;
+		case SNAPSHOT_RECORD_VARIABLE:
+			apply_variable_record(map + off + sizeof(rec), rec.len);
+			break;
+		case SNAPSHOT_RECORD_UNSET:
+			apply_unset_record(map + off + sizeof(rec), rec.len);
+			break;
+		}
+	}
+
+	munmap((void *)map, st.st_size);
+	return true;
+}
+
+static void write_record(FILE *f, uint32_t type, const void *data,
+			 uint32_t len)
+{
+	struct snapshot_record rec = { .type = type, .len = len };
+
+	fwrite(&rec, sizeof(rec), 1, f);
+	fwrite(data, len, 1, f);
+}
+
+/**
+ * save_snapshot() - write the current shell state as a snapshot
+ *
+ * The snapshot is written to a temporary file and renamed into place,
+ * so a concurrently starting shell never sees a partial snapshot.
+ */
+static void save_snapshot(const char *path, const struct stat *rc_st)
+{
+	struct snapshot_header hdr = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.rc_mtime_sec = rc_st->st_mtim.tv_sec,
+		.rc_mtime_nsec = rc_st->st_mtim.tv_nsec,
+		.rc_size = rc_st->st_size,
+		.rc_ino = rc_st->st_ino,
+	};
+	char *tmp_path = malloc(strlen(path) + 32);
+	char data[64];
+	size_t name_len;
+	FILE *f;
+
+	sprintf(tmp_path, "%s.%ld", path, (long)getpid());
+	f = fopen(tmp_path, "we");
+	if (!f) {
+		free(tmp_path);
+		return;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	for (int i = 0; i < SHELL_OPTION_COUNT; i++) {
+		name_len = strlen(shell_option_names[i]) + 1;
+		if (name_len + 1 > sizeof(data))
+			continue;
+		memcpy(data, shell_option_names[i], name_len);
+		data[name_len] = shell_options[i];
+		write_record(f, SNAPSHOT_RECORD_OPTION, data, name_len + 1);
+	}
+	fwrite(var_journal, var_journal_len, 1, f);
+
+	if (fclose(f) || rename(tmp_path, path) < 0) {
+		fprintf(stderr, "Unable to write %s: %s\n", path,
+			strerror(errno));
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+}
+
+int load_rc_file(int (*dispatcher)(const char *line, int last_rv,
+				   bool *shell_should_exit),
+		 bool *shell_should_exit)
+{
+	char *rc_path = home_path(RC_FILE_NAME);
+	char *snap_path = home_path(SNAPSHOT_FILE_NAME);
+	struct stat rc_st;
+	FILE *rc;
+	int rv = 0;
+
+	if (!rc_path || !snap_path)
+		goto out;
+
+	rc = fopen(rc_path, "re");
+	if (!rc) {
+		if (errno != ENOENT)
+			fprintf(stderr, "%s: %s\n", rc_path, strerror(errno));
+		goto out;
+	}
+
+	if (fstat(fileno(rc), &rc_st) < 0 || load_snapshot(snap_path, &rc_st)) {
+		fclose(rc);
+		goto out;
+	}
+
+	rc_cacheable = true;
+	rc_dispatcher = dispatcher;
+	var_change_hook = journal_var_change;
+	rv = run_script(rc, rc_path, 0, rc_dispatch, shell_should_exit);
+	var_change_hook = NULL;
+	fclose(rc);
+
+	if (rc_cacheable && !*shell_should_exit)
+		save_snapshot(snap_path, &rc_st);
+	else
+		unlink(snap_path);
+
+out:
+	free(var_journal);
+	var_journal = NULL;
+	var_journal_len = 0;
+	free(rc_path);
+	free(snap_path);
+	return rv;
+}
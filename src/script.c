@@ -0,0 +1,52 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+
+/* The innermost running script, if any. */
+static const char *script_name;
+static unsigned long script_line;
+
+int run_script(FILE *stream, const char *name, int last_rv,
+	       int (*dispatcher)(const char *line, int last_rv,
+				 bool *shell_should_exit),
+	       bool *shell_should_exit)
+{
+	const char *outer_name = script_name;
+	unsigned long outer_line = script_line;
+	unsigned long line_no = 0;
+	char *line = NULL;
+	size_t line_sz = 0;
+	ssize_t len;
+
+	while (!*shell_should_exit &&
+	       (len = getline(&line, &line_sz, stream)) >= 0) {
+		if (len && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+
+		/* A nested script may have moved the position on. */
+		script_name = name;
+		script_line = ++line_no;
+		last_rv = dispatcher(line, last_rv, shell_should_exit);
+	}
+	if (ferror(stream)) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		last_rv = 1;
+	}
+
+	script_name = outer_name;
+	script_line = outer_line;
+	free(line);
+	return last_rv;
+}
+
+void script_print_position(FILE *stream)
+{
+	if (script_name)
+		fprintf(stream, "%s:%lu: ", script_name, script_line);
+}
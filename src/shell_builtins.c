@@ -1,13 +1,56 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <termios.h>
 #include <unistd.h>
 
 #include <readline/history.h>
 
+#include "bench.h"
+#include "builtin_hash.h"
+#include "common.h"
+#include "dispatcher.h"
+#include "histindex.h"
+#include "jobs.h"
+#include "memo.h"
+#include "options.h"
+#include "parallel.h"
+#include "output.h"
+#include "pathcache.h"
+#include "script.h"
 #include "shell_builtins.h"
+#include "stats.h"
+#include "strhash.h"
+#include "trace.h"
+#include "variables.h"
+#include "workdir.h"
+
+_Thread_local int builtin_input_fd = STDIN_FILENO;
+_Thread_local bool builtin_input_redirected;
+_Thread_local char *const *builtin_envp;
+
+/* A builtin loaded from a shared object with "enable -f". */
+struct loaded_builtin {
+	struct builtin_command cmd;
+	void *handle;
+	char *path;
+};
+
+static struct loaded_builtin *loaded_builtins;
+static size_t n_loaded_builtins;
 
 static int exit_builtin(const char *const argv[], int last_rv,
 			bool *shell_should_exit)
@@ -31,58 +74,2081 @@ static int exit_builtin(const char *const argv[], int last_rv,
 	return status;
 }
 
+/**
+ * cd_builtin() - change the current directory
+ *
+ * The directory is tracked logically, so "cd .." after following a
+ * symbolic link goes back where it came from, unless -P is given.
+ * "cd -" goes to $OLDPWD, and relative names are searched for in
+ * $CDPATH.  Both print the new directory.
+ */
 static int cd_builtin(const char *const argv[], int last_rv, bool *unused)
 {
+	bool physical = false;
+	bool print = false;
+	bool from_cdpath;
 	const char *dir;
+	char *target;
+	size_t i = 1;
 
-	dir = getenv("HOME");
-	if (argv[1]) {
-		dir = argv[1];
-		if (argv[2]) {
-			fprintf(stderr, "usage: %s [dir]\n", argv[0]);
+	for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (!strcmp(argv[i], "--")) {
+			i++;
+			break;
+		}
+		if (strcmp(argv[i], "-L") && strcmp(argv[i], "-P"))
+			goto usage;
+		physical = argv[i][1] == 'P';
+	}
+	if (argv[i] && argv[i + 1])
+		goto usage;
+
+	dir = argv[i];
+	if (!dir) {
+		dir = var_get("HOME");
+		if (!dir) {
+			fprintf(stderr, "%s: HOME not set\n", argv[0]);
+			return 1;
+		}
+	} else if (!strcmp(dir, "-")) {
+		dir = var_get("OLDPWD");
+		if (!dir) {
+			fprintf(stderr, "%s: OLDPWD not set\n", argv[0]);
 			return 1;
 		}
+		print = true;
 	}
 
-	if (chdir(dir) < 0) {
-		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+	target = cdpath_lookup(dir, &from_cdpath);
+	if (workdir_change(target, physical) < 0) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], target,
+			strerror(errno));
+		free(target);
 		return 1;
 	}
+	free(target);
 
+	if (print || from_cdpath)
+		bout_printf("%s\n", workdir_get());
 	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-L | -P] [dir | -]\n", argv[0]);
+	return 1;
 }
 
 static int help_builtin(const char *const argv[], int last_rv, bool *unused)
 {
-	printf("This is CSCI-442 shell!\n\n");
-	printf("Builtin commmands are:\n ");
+	bout_puts("This is CSCI-442 shell!\n\n");
+	bout_puts("Builtin commmands are:\n ");
 	for (size_t i = 0; builtin_commands[i].name; i++)
-		printf(" %s", builtin_commands[i].name);
-	printf("\n");
+		bout_printf(" %s", builtin_commands[i].name);
+	for (size_t i = 0; i < n_loaded_builtins; i++)
+		bout_printf(" %s", loaded_builtins[i].cmd.name);
+	bout_puts("\n");
 	return 0;
 }
 
+/**
+ * print_history() - print the last @count history entries
+ *
+ * The history list is an array, so this starts directly at the first
+ * entry to print, rather than walking the entries before it.
+ */
+static void print_history(int count)
+{
+	HIST_ENTRY **histlst = history_list();
+	int first = history_length - count;
+
+	if (!histlst)
+		return;
+	if (first < 0)
+		first = 0;
+
+	for (int i = first; i < history_length; i++)
+		bout_printf("%4d %s\n", history_base + i, histlst[i]->line);
+}
+
 static int history_builtin(const char *const argv[], int last_rv, bool *unused)
 {
-	if (!argv[1]) {
-		HIST_ENTRY **histlst = history_list();
+	int count;
+	char end;
 
-		for (int i = 1; *histlst; i++, histlst++)
-			printf("%4d %s\n", i, (*histlst)->line);
+	if (!argv[1]) {
+		print_history(history_length);
 	} else if (!argv[2] && !strcmp(argv[1], "-c")) {
 		clear_history();
+		hist_index_clear();
+	} else if (!argv[2] && sscanf(argv[1], "%d%c", &count, &end) == 1 &&
+		   count >= 0) {
+		print_history(count);
+	} else {
+		fprintf(stderr, "usage: %s [-c | N]\n", argv[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int set_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	int opt;
+
+	if (!argv[1] || (!strcmp(argv[1], "-o") && !argv[2])) {
+		for (int i = 0; i < SHELL_OPTION_COUNT; i++)
+			bout_printf("%-16s %s\n", shell_option_names[i],
+				    shell_options[i] ? "on" : "off");
+		return 0;
+	}
+
+	for (size_t i = 1; argv[i]; i += 2) {
+		if ((strcmp(argv[i], "-o") && strcmp(argv[i], "+o")) ||
+		    !argv[i + 1]) {
+			fprintf(stderr, "usage: %s [-o|+o option]...\n",
+				argv[0]);
+			return 1;
+		}
+		opt = shell_option_lookup(argv[i + 1]);
+		if (opt < 0) {
+			fprintf(stderr, "%s: %s: invalid option name\n",
+				argv[0], argv[i + 1]);
+			return 1;
+		}
+		shell_options[opt] = argv[i][0] == '-';
+	}
+
+	return 0;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int export_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	char *const *envp = var_envp();
+	bool exported = true;
+	const char **sorted;
+	const char *eq;
+	size_t n = 0;
+	size_t i = 1;
+	char *name;
+	int rv = 0;
+
+	for (; argv[i] && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-n")) {
+			exported = false;
+		} else if (strcmp(argv[i], "-p")) {
+			fprintf(stderr, "usage: %s [-n] [name[=value]...]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (!argv[i]) {
+		while (envp[n])
+			n++;
+		sorted = malloc(n * sizeof(*sorted));
+		memcpy(sorted, envp, n * sizeof(*sorted));
+		qsort(sorted, n, sizeof(*sorted), compare_strings);
+		for (i = 0; i < n; i++)
+			bout_printf("export %s\n", sorted[i]);
+		free(sorted);
+		return 0;
+	}
+
+	for (; argv[i]; i++) {
+		eq = strchr(argv[i], '=');
+		name = strndup(argv[i], eq ? (size_t)(eq - argv[i]) :
+					     strlen(argv[i]));
+		if (eq && var_set(name, eq + 1, exported ? VAR_EXPORT : 0) < 0) {
+			fprintf(stderr, "%s: %s: not a valid identifier\n",
+				argv[0], name);
+			rv = 1;
+		} else if (var_export(name, exported) < 0) {
+			fprintf(stderr, "%s: %s: not a valid identifier\n",
+				argv[0], name);
+			rv = 1;
+		}
+		free(name);
+	}
+
+	return rv;
+}
+
+static int unset_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	int rv = 0;
+
+	for (size_t i = 1; argv[i]; i++) {
+		if (var_unset(argv[i]) < 0) {
+			fprintf(stderr, "%s: %s: not a valid identifier\n",
+				argv[0], argv[i]);
+			rv = 1;
+		}
+	}
+
+	return rv;
+}
+
+/**
+ * run_external() - run an external command from a builtin
+ *
+ * The command reads from the builtin's input and writes to its
+ * output, and this waits for it to finish.  It is started as a
+ * pipeline stage would be, so it is counted and traced the same way.
+ *
+ * Return: the exit status of the command.
+ */
+static int run_external(const char *const argv[], char *const envp[])
+{
+	pid_t pid;
+
+	if (bout_flush() < 0)
+		return 1;
+	pid = spawn_external(argv, envp, builtin_input_fd, bout_fd(),
+			     STDERR_FILENO);
+	if (pid < 0)
+		return 1;
+	return wait_command(pid);
+}
+
+static int env_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	char *const *envp = builtin_envp ? builtin_envp : var_envp();
+
+	if (!argv[1]) {
+		for (; *envp; envp++)
+			bout_printf("%s\n", *envp);
+		return 0;
+	}
+
+	/* Running a command is left to env(1), in the shell's environment. */
+	return run_external(argv, envp);
+}
+
+/* How describe_command() prints what a name refers to. */
+enum describe_style {
+	/* "NAME is a shell builtin", or "NAME is PATH", as for "type". */
+	DESCRIBE_SENTENCE,
+	/* "builtin" or "file", as for "type -t". */
+	DESCRIBE_WORD,
+	/* The name of a builtin, or the path, as for "command -v". */
+	DESCRIBE_NAME,
+	/* Only paths, ignoring builtins, as for "which" and "type -p". */
+	DESCRIBE_PATH_ONLY,
+};
+
+/**
+ * describe_command() - print what running @name would run
+ *
+ * Builtins are found in the builtin table, and programs through the
+ * path cache, so nothing is executed.
+ *
+ * @all:    List every builtin and PATH match, rather than just the
+ *          one which would run.  The PATH is still only scanned once.
+ *
+ * Return: zero if @name was found, or 1 if not.
+ */
+static int describe_command(const char *name, enum describe_style style,
+			    bool all)
+{
+	bool found = false;
+	char **paths;
+
+	if (style != DESCRIBE_PATH_ONLY && find_builtin(name)) {
+		if (style == DESCRIBE_SENTENCE)
+			bout_printf("%s is a shell builtin\n", name);
+		else if (style == DESCRIBE_WORD)
+			bout_puts("builtin\n");
+		else
+			bout_printf("%s\n", name);
+		if (!all)
+			return 0;
+		found = true;
+	}
+
+	if (all || strchr(name, '/')) {
+		paths = path_lookup_all(name);
+	} else {
+		paths = calloc(2, sizeof(*paths));
+		paths[0] = path_lookup(name);
+	}
+
+	for (char **path = paths; *path; path++) {
+		if (style == DESCRIBE_SENTENCE)
+			bout_printf("%s is %s\n", name, *path);
+		else if (style == DESCRIBE_WORD)
+			bout_puts("file\n");
+		else
+			bout_printf("%s\n", *path);
+		free(*path);
+		found = true;
+	}
+	free(paths);
+	return !found;
+}
+
+static int type_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	enum describe_style style = DESCRIBE_SENTENCE;
+	bool all = false;
+	size_t i = 1;
+	int rv = 0;
+
+	for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (!strcmp(argv[i], "-a")) {
+			all = true;
+		} else if (!strcmp(argv[i], "-t")) {
+			style = DESCRIBE_WORD;
+		} else if (!strcmp(argv[i], "-p")) {
+			style = DESCRIBE_PATH_ONLY;
+		} else {
+			fprintf(stderr, "usage: %s [-a] [-t | -p] name...\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	for (; argv[i]; i++) {
+		if (describe_command(argv[i], style, all)) {
+			if (style == DESCRIBE_SENTENCE)
+				fprintf(stderr, "%s: %s: not found\n",
+					argv[0], argv[i]);
+			rv = 1;
+		}
+	}
+	return rv;
+}
+
+static int which_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	bool all = false;
+	size_t i = 1;
+	int rv = 0;
+
+	if (argv[i] && !strcmp(argv[i], "-a")) {
+		all = true;
+		i++;
+	}
+	for (; argv[i]; i++)
+		rv |= describe_command(argv[i], DESCRIBE_PATH_ONLY, all);
+	return rv;
+}
+
+static int command_builtin(const char *const argv[], int last_rv,
+			   bool *shell_should_exit)
+{
+	const struct builtin_command *builtin;
+	char mode = '\0';
+	size_t i = 1;
+	int rv = 0;
+
+	for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (!strcmp(argv[i], "--")) {
+			i++;
+			break;
+		}
+		if (strcmp(argv[i], "-v") && strcmp(argv[i], "-V")) {
+			fprintf(stderr,
+				"usage: %s [-v | -V] name [argument...]\n",
+				argv[0]);
+			return 1;
+		}
+		mode = argv[i][1];
+	}
+	if (!argv[i])
+		return 0;
+
+	if (mode) {
+		for (; argv[i]; i++) {
+			if (!describe_command(argv[i],
+					      mode == 'v' ? DESCRIBE_NAME :
+							    DESCRIBE_SENTENCE,
+					      false))
+				continue;
+			if (mode == 'V')
+				fprintf(stderr, "%s: %s: not found\n",
+					argv[0], argv[i]);
+			rv = 1;
+		}
+		return rv;
+	}
+
+	builtin = find_builtin(argv[i]);
+	if (builtin)
+		return builtin->handler(argv + i, last_rv, shell_should_exit);
+	return run_external(argv + i,
+			    builtin_envp ? builtin_envp : var_envp());
+}
+
+/**
+ * exec_builtin() - replace the shell with a command, without forking
+ *
+ * Without a command, only the redirections are performed, and they
+ * stay in place for the rest of the session, as for "exec >log 2>&1"
+ * or "exec 3<file".  The dispatcher does both, through
+ * BUILTIN_PERSISTENT_REDIRECTIONS, so the command inherits the
+ * redirected fds directly.
+ */
+static int exec_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	char *path;
+
+	if (!argv[1])
+		return 0;
+
+	path = path_lookup(argv[1]);
+	if (!path) {
+		fprintf(stderr, "%s: %s: not found\n", argv[0], argv[1]);
+		return 127;
+	}
+	if (bout_flush() < 0) {
+		free(path);
+		return 1;
+	}
+	fflush(stdout);
+
+	exec_path(path, argv + 1, builtin_envp ? builtin_envp : var_envp());
+	fprintf(stderr, "%s: %s: %s\n", argv[0], path, strerror(errno));
+	free(path);
+	return 126;
+}
+
+/* How deeply "source" may nest, to stop a file sourcing itself forever. */
+#define SOURCE_MAX_DEPTH 64
+
+/**
+ * swap_fd() - move @fd onto @target, returning a copy of the old one
+ *
+ * Return: the saved copy of @target, or -1 if nothing was moved.
+ */
+static int swap_fd(int fd, int target)
+{
+	int saved;
+
+	if (fd == target)
+		return -1;
+	saved = fcntl(target, F_DUPFD_CLOEXEC, 0);
+	dup2(fd, target);
+	return saved;
+}
+
+static void restore_fd(int saved, int target)
+{
+	if (saved < 0)
+		return;
+	dup2(saved, target);
+	close(saved);
+}
+
+/* Flags for print_escape(). */
+#define ESCAPE_OCTAL_0 (1 << 0) /* Octal may also be written \0NNN. */
+#define ESCAPE_DQUOTE (1 << 1) /* \" is a double quote. */
+
+static int hex_value(char c)
+{
+	return isdigit((unsigned char)c) ? c - '0' :
+					   tolower((unsigned char)c) - 'a' + 10;
+}
+
+/**
+ * print_escape() - print the character for a backslash escape
+ *
+ * These are the escapes of "echo -e", printf formats and printf's %b,
+ * as in coreutils.  Unknown escapes are printed as they are.
+ *
+ * @p:      The escape, after the backslash.
+ * @flags:  ESCAPE_* flags.
+ * @stop:   Set to true for \c, which ends all output.
+ *
+ * Return: the number of characters of @p consumed.
+ */
+static size_t print_escape(const char *p, int flags, bool *stop)
+{
+	const char *q = p + 1;
+	char value;
+	int digits;
+
+	switch (*p) {
+	case '\\': value = '\\'; break;
+	case 'a': value = '\a'; break;
+	case 'b': value = '\b'; break;
+	case 'e': value = '\033'; break;
+	case 'f': value = '\f'; break;
+	case 'n': value = '\n'; break;
+	case 'r': value = '\r'; break;
+	case 't': value = '\t'; break;
+	case 'v': value = '\v'; break;
+	case 'c':
+		*stop = true;
+		return 1;
+	case 'x':
+		if (!isxdigit((unsigned char)*q))
+			goto unknown;
+		value = 0;
+		for (digits = 0; digits < 2 && isxdigit((unsigned char)*q);
+		     digits++, q++)
+			value = value * 16 + hex_value(*q);
+		break;
+	case '0' ... '7':
+		q = p;
+		if ((flags & ESCAPE_OCTAL_0) && *q == '0')
+			q++;
+		value = 0;
+		for (digits = 0; digits < 3 && *q >= '0' && *q <= '7';
+		     digits++, q++)
+			value = value * 8 + *q - '0';
+		break;
+	case '"':
+		if (!(flags & ESCAPE_DQUOTE))
+			goto unknown;
+		value = '"';
+		break;
+	default:
+		goto unknown;
+	}
+
+	bout_write(&value, 1);
+	return q - p;
+
+unknown:
+	bout_write(p - 1, *p ? 2 : 1);
+	return *p ? 1 : 0;
+}
+
+/**
+ * print_escaped() - print a string, interpreting backslash escapes
+ *
+ * Return: true if the string contained \c, so output should stop.
+ */
+static bool print_escaped(const char *str, int flags)
+{
+	bool stop = false;
+	size_t span;
+
+	while (*str && !stop) {
+		span = strcspn(str, "\\");
+		bout_write(str, span);
+		str += span;
+		if (*str)
+			str += 1 + print_escape(str + 1, flags, &stop);
+	}
+	return stop;
+}
+
+static int echo_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	bool newline = true;
+	bool escapes = false;
+	size_t i = 1;
+
+	/* Like coreutils, only arguments made entirely of options count. */
+	for (; argv[i] && argv[i][0] == '-' && argv[i][1] &&
+	       !argv[i][1 + strspn(argv[i] + 1, "neE")];
+	     i++) {
+		for (const char *p = argv[i] + 1; *p; p++) {
+			if (*p == 'n')
+				newline = false;
+			else
+				escapes = *p == 'e';
+		}
+	}
+
+	for (; argv[i]; i++) {
+		if (!escapes)
+			bout_puts(argv[i]);
+		else if (print_escaped(argv[i], ESCAPE_OCTAL_0))
+			return 0;
+		if (argv[i + 1])
+			bout_puts(" ");
+	}
+	if (newline)
+		bout_puts("\n");
+	return 0;
+}
+
+/**
+ * check_conversion() - report a bad numeric argument, as coreutils does
+ *
+ * Return: zero if @arg was converted in full, or 1 if not.
+ */
+static int check_conversion(const char *arg, const char *end)
+{
+	if (errno == ERANGE) {
+		fprintf(stderr, "printf: '%s': %s\n", arg, strerror(ERANGE));
+	} else if (end == arg) {
+		fprintf(stderr, "printf: '%s': expected a numeric value\n",
+			arg);
+	} else if (*end) {
+		fprintf(stderr, "printf: '%s': value not completely converted\n",
+			arg);
 	} else {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Arguments which start with a quote convert to the value of the
+ * character after it.  Missing arguments, passed as NULL, are zero.
+ */
+static bool is_constant(const char *arg)
+{
+	return !arg || *arg == '\'' || *arg == '"';
+}
+
+static unsigned char constant_value(const char *arg)
+{
+	return arg ? arg[1] : 0;
+}
+
+static intmax_t printf_intmax(const char *arg, int *rv)
+{
+	intmax_t value;
+	char *end;
+
+	if (is_constant(arg))
+		return constant_value(arg);
+	errno = 0;
+	value = strtoimax(arg, &end, 0);
+	*rv |= check_conversion(arg, end);
+	return value;
+}
+
+static uintmax_t printf_uintmax(const char *arg, int *rv)
+{
+	uintmax_t value;
+	char *end;
+
+	if (is_constant(arg))
+		return constant_value(arg);
+	errno = 0;
+	value = strtoumax(arg, &end, 0);
+	*rv |= check_conversion(arg, end);
+	return value;
+}
+
+static long double printf_long_double(const char *arg, int *rv)
+{
+	long double value;
+	char *end;
+
+	if (is_constant(arg))
+		return constant_value(arg);
+	errno = 0;
+	value = strtold(arg, &end);
+	*rv |= check_conversion(arg, end);
+	return value;
+}
+
+/**
+ * print_format() - print @format once, taking values from @args
+ *
+ * Missing arguments are taken to be empty strings, or zero.
+ *
+ * @rv:     Set to 1 if an argument could not be converted.
+ * @stop:   Set to true if output should stop, after \c or an invalid
+ *          conversion.
+ *
+ * Return: the arguments which were not used.
+ */
+static const char *const *print_format(const char *format,
+				       const char *const *args, int *rv,
+				       bool *stop)
+{
+	const char *p = format;
+	const char *conversion;
+	const char *arg;
+	size_t span, len;
+	char *spec;
+	char *s;
+
+	/* Enough for any conversion, with its '*'s replaced. */
+	spec = malloc(strlen(format) + 64);
+
+	while (*p && !*stop) {
+		span = strcspn(p, "\\%");
+		bout_write(p, span);
+		p += span;
+
+		if (*p == '\\') {
+			p += 1 + print_escape(p + 1, ESCAPE_DQUOTE, stop);
+			continue;
+		}
+		if (!*p)
+			break;
+		if (p[1] == '%') {
+			bout_puts("%");
+			p += 2;
+			continue;
+		}
+
+		/* Copy the flags, width and precision into spec. */
+		conversion = p;
+		s = spec;
+		*s++ = *p++;
+		len = strspn(p, "-+ #0'");
+		memcpy(s, p, len);
+		s += len;
+		p += len;
+		for (int part = 0; part < 2; part++) {
+			if (part) {
+				if (*p != '.')
+					break;
+				*s++ = *p++;
+			}
+			if (*p == '*') {
+				arg = *args ? *args++ : NULL;
+				s += sprintf(s, "%d",
+					     (int)printf_intmax(arg, rv));
+				p++;
+			} else {
+				len = strspn(p, "0123456789");
+				memcpy(s, p, len);
+				s += len;
+				p += len;
+			}
+		}
+		/* Length modifiers are accepted, and ignored. */
+		p += strspn(p, "hlLqjzt");
+
+		arg = *args ? *args++ : NULL;
+		switch (*p) {
+		case 'd':
+		case 'i':
+			strcpy(s, (char[]){ 'j', *p, '\0' });
+			bout_printf(spec, printf_intmax(arg, rv));
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			strcpy(s, (char[]){ 'j', *p, '\0' });
+			if (arg && *arg == '-')
+				bout_printf(spec,
+					    (uintmax_t)printf_intmax(arg, rv));
+			else
+				bout_printf(spec, printf_uintmax(arg, rv));
+			break;
+		case 'a':
+		case 'A':
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			strcpy(s, (char[]){ 'L', *p, '\0' });
+			bout_printf(spec, printf_long_double(arg, rv));
+			break;
+		case 'c':
+			strcpy(s, "c");
+			bout_printf(spec, arg ? *arg : '\0');
+			break;
+		case 's':
+			strcpy(s, "s");
+			bout_printf(spec, arg ? arg : "");
+			break;
+		case 'b':
+			*stop = arg && print_escaped(arg, ESCAPE_OCTAL_0);
+			break;
+		default:
+			fprintf(stderr,
+				"printf: %.*s: invalid conversion specification\n",
+				(int)(p - conversion + (*p ? 1 : 0)), conversion);
+			*rv = 1;
+			*stop = true;
+			break;
+		}
+		if (*p)
+			p++;
+	}
+
+	free(spec);
+	return args;
+}
+
+static int printf_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	const char *const *args = argv + 1;
+	const char *const *rest;
+	const char *format;
+	bool stop = false;
+	int rv = 0;
+
+	if (*args && !strcmp(*args, "--"))
+		args++;
+	if (!*args) {
+		fprintf(stderr, "usage: %s format [argument...]\n", argv[0]);
+		return 1;
+	}
+	format = *args++;
+
+	/* The format is reused until every argument is consumed. */
+	do {
+		rest = print_format(format, args, &rv, &stop);
+		if (rest == args)
+			break;
+		args = rest;
+	} while (*args && !stop);
+
+	return rv;
+}
+
+/* The operands of a running "test", and the position in them. */
+struct test_args {
+	const char *name;
+	const char *const *argv;
+	int argc;
+	int pos;
+	bool error;
+};
+
+/**
+ * test_error() - report a syntax error in the operands of "test"
+ *
+ * Only the first error is reported.
+ *
+ * Return: false, for convenience.
+ */
+static bool __attribute__((format(printf, 2, 3)))
+test_error(struct test_args *t, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!t->error) {
+		fprintf(stderr, "%s: ", t->name);
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fputc('\n', stderr);
+	}
+	t->error = true;
+	return false;
+}
+
+static bool is_unary_op(const char *op)
+{
+	return op[0] == '-' && op[1] && !op[2] &&
+	       strchr("bcdefghkLnOGprsStuwxz", op[1]);
+}
+
+static bool is_binary_op(const char *op)
+{
+	static const char *const binary_ops[] = {
+		"=",   "==",  "!=",  "-eq", "-ne", "-lt",
+		"-le", "-gt", "-ge", "-nt", "-ot", "-ef",
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(binary_ops); i++) {
+		if (!strcmp(op, binary_ops[i]))
+			return true;
+	}
+	return false;
+}
+
+static intmax_t test_integer(struct test_args *t, const char *arg)
+{
+	const char *p = arg + strspn(arg, " \t\n");
+	intmax_t value;
+	char *end;
+
+	if (*p == '+' || *p == '-')
+		p++;
+	if (!isdigit((unsigned char)*p)) {
+		test_error(t, "invalid integer '%s'", arg);
+		return 0;
+	}
+	value = strtoimax(arg, &end, 10);
+	if (end[strspn(end, " \t\n")])
+		test_error(t, "invalid integer '%s'", arg);
+	return value;
+}
+
+static bool test_unary(struct test_args *t, char op, const char *arg)
+{
+	struct stat st;
+	int flags = op == 'h' || op == 'L' ? AT_SYMLINK_NOFOLLOW : 0;
+	int mode;
+
+	switch (op) {
+	case 'n':
+		return *arg;
+	case 'z':
+		return !*arg;
+	case 't':
+		return isatty(test_integer(t, arg));
+	case 'r':
+	case 'w':
+	case 'x':
+		mode = op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK;
+		return !faccessat(AT_FDCWD, arg, mode, AT_EACCESS);
+	}
+
+	if (fstatat(AT_FDCWD, arg, &st, flags) < 0)
+		return false;
+
+	switch (op) {
+	case 'b':
+		return S_ISBLK(st.st_mode);
+	case 'c':
+		return S_ISCHR(st.st_mode);
+	case 'd':
+		return S_ISDIR(st.st_mode);
+	case 'e':
+		return true;
+	case 'f':
+		return S_ISREG(st.st_mode);
+	case 'g':
+		return st.st_mode & S_ISGID;
+	case 'h':
+	case 'L':
+		return S_ISLNK(st.st_mode);
+	case 'k':
+		return st.st_mode & S_ISVTX;
+	case 'O':
+		return st.st_uid == geteuid();
+	case 'G':
+		return st.st_gid == getegid();
+	case 'p':
+		return S_ISFIFO(st.st_mode);
+	case 's':
+		return st.st_size > 0;
+	case 'S':
+		return S_ISSOCK(st.st_mode);
+	case 'u':
+		return st.st_mode & S_ISUID;
+	}
+	return false;
+}
+
+/*
+ * Compare the modification times of two files, which compare older
+ * than any existing file when they do not exist.
+ */
+static int compare_mtimes(const char *a, const char *b)
+{
+	struct stat sta, stb;
+	bool has_a = !fstatat(AT_FDCWD, a, &sta, 0);
+	bool has_b = !fstatat(AT_FDCWD, b, &stb, 0);
+
+	if (!has_a || !has_b)
+		return has_a - has_b;
+	if (sta.st_mtim.tv_sec != stb.st_mtim.tv_sec)
+		return sta.st_mtim.tv_sec < stb.st_mtim.tv_sec ? -1 : 1;
+	if (sta.st_mtim.tv_nsec != stb.st_mtim.tv_nsec)
+		return sta.st_mtim.tv_nsec < stb.st_mtim.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+static bool test_binary(struct test_args *t, const char *a, const char *op,
+			const char *b)
+{
+	struct stat sta, stb;
+	intmax_t x, y;
+
+	if (!strcmp(op, "=") || !strcmp(op, "=="))
+		return !strcmp(a, b);
+	if (!strcmp(op, "!="))
+		return strcmp(a, b);
+	if (!strcmp(op, "-nt"))
+		return compare_mtimes(a, b) > 0;
+	if (!strcmp(op, "-ot"))
+		return compare_mtimes(a, b) < 0;
+	if (!strcmp(op, "-ef"))
+		return !fstatat(AT_FDCWD, a, &sta, 0) &&
+		       !fstatat(AT_FDCWD, b, &stb, 0) &&
+		       sta.st_dev == stb.st_dev && sta.st_ino == stb.st_ino;
+
+	x = test_integer(t, a);
+	y = test_integer(t, b);
+	if (!strcmp(op, "-eq"))
+		return x == y;
+	if (!strcmp(op, "-ne"))
+		return x != y;
+	if (!strcmp(op, "-lt"))
+		return x < y;
+	if (!strcmp(op, "-le"))
+		return x <= y;
+	if (!strcmp(op, "-gt"))
+		return x > y;
+	return x >= y;
+}
+
+static bool test_or(struct test_args *t);
+
+static bool test_primary(struct test_args *t)
+{
+	const char *arg;
+	bool result;
+
+	if (t->pos >= t->argc)
+		return test_error(t, "argument expected");
+	arg = t->argv[t->pos];
+
+	if (t->pos + 2 < t->argc && is_binary_op(t->argv[t->pos + 1])) {
+		t->pos += 3;
+		return test_binary(t, arg, t->argv[t->pos - 2],
+				   t->argv[t->pos - 1]);
+	}
+	if (!strcmp(arg, "(")) {
+		t->pos++;
+		result = test_or(t);
+		if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")"))
+			return test_error(t, "')' expected");
+		t->pos++;
+		return result;
+	}
+	if (is_unary_op(arg)) {
+		if (t->pos + 1 >= t->argc)
+			return test_error(t, "missing argument after '%s'",
+					  arg);
+		t->pos += 2;
+		return test_unary(t, arg[1], t->argv[t->pos - 1]);
+	}
+	t->pos++;
+	return *arg;
+}
+
+static bool test_not(struct test_args *t)
+{
+	if (t->pos < t->argc && !strcmp(t->argv[t->pos], "!")) {
+		t->pos++;
+		return !test_not(t);
+	}
+	return test_primary(t);
+}
+
+static bool test_and(struct test_args *t)
+{
+	bool result = test_not(t);
+
+	while (t->pos < t->argc && !strcmp(t->argv[t->pos], "-a")) {
+		t->pos++;
+		result = test_not(t) && result;
+	}
+	return result;
+}
+
+static bool test_or(struct test_args *t)
+{
+	bool result = test_and(t);
+
+	while (t->pos < t->argc && !strcmp(t->argv[t->pos], "-o")) {
+		t->pos++;
+		result = test_and(t) || result;
+	}
+	return result;
+}
+
+/**
+ * test_expression() - evaluate the operands of "test" from @t->pos
+ *
+ * Up to four operands are handled by their number, as POSIX
+ * specifies, so that operands which look like operators are still
+ * taken as strings where that is the only sensible reading.  Longer
+ * expressions are parsed with the usual precedence of "!", "-a" and
+ * "-o".
+ */
+static bool test_expression(struct test_args *t)
+{
+	const char *const *argv = t->argv + t->pos;
+	int n = t->argc - t->pos;
+	bool result;
+
+	switch (n) {
+	case 0:
+		return false;
+	case 1:
+		t->pos++;
+		return *argv[0];
+	case 2:
+		if (!strcmp(argv[0], "!")) {
+			t->pos += 2;
+			return !*argv[1];
+		}
+		if (!is_unary_op(argv[0]))
+			return test_error(t, "'%s': unary operator expected",
+					  argv[0]);
+		break;
+	case 3:
+		if (!strcmp(argv[1], "-a") || !strcmp(argv[1], "-o")) {
+			t->pos += 3;
+			return argv[1][1] == 'a' ? *argv[0] && *argv[2] :
+						   *argv[0] || *argv[2];
+		}
+		if (is_binary_op(argv[1]))
+			break;
+		if (!strcmp(argv[0], "!")) {
+			t->pos++;
+			return !test_expression(t);
+		}
+		if (!strcmp(argv[0], "(") && !strcmp(argv[2], ")")) {
+			t->pos += 3;
+			return *argv[1];
+		}
+		return test_error(t, "'%s': binary operator expected",
+				  argv[1]);
+	case 4:
+		if (!strcmp(argv[0], "!")) {
+			t->pos++;
+			return !test_expression(t);
+		}
+		if (!strcmp(argv[0], "(") && !strcmp(argv[3], ")")) {
+			t->argc--;
+			t->pos++;
+			result = test_expression(t);
+			t->argc++;
+			t->pos++;
+			return result;
+		}
+		break;
+	}
+
+	return test_or(t);
+}
+
+static int test_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	struct test_args t = { .name = argv[0], .argv = argv + 1 };
+	bool result;
+
+	while (t.argv[t.argc])
+		t.argc++;
+	if (!strcmp(argv[0], "[")) {
+		if (!t.argc || strcmp(t.argv[t.argc - 1], "]")) {
+			fprintf(stderr, "%s: missing ']'\n", argv[0]);
+			return 2;
+		}
+		t.argc--;
+	}
+
+	result = test_expression(&t);
+	if (!t.error && t.pos < t.argc)
+		test_error(&t, "extra argument '%s'", t.argv[t.pos]);
+	return t.error ? 2 : !result;
+}
+
+/* How much "read" asks for at once, when it is safe to over-read. */
+#define READ_BLOCK_SIZE 8192
+
+/*
+ * Whether a read(2) of @fd returns at most one line, as it does for
+ * a terminal in canonical mode.
+ */
+static bool reads_by_line(int fd)
+{
+	struct termios t;
+
+	return isatty(fd) && !tcgetattr(fd, &t) && (t.c_lflag & ICANON);
+}
+
+/**
+ * read_input_line() - read one line from @fd, consuming nothing after it
+ *
+ * The shell and the commands run after "read" share @fd, so no input
+ * past the newline may be lost.  When @fd is seekable, this reads
+ * whole blocks and seeks back to just after the newline.  Terminals
+ * in canonical mode never return more than a line, so they are also
+ * read in blocks.  Only other fds, such as pipes, need to be read a
+ * byte at a time.
+ *
+ * @buf, @buf_sz:  A buffer for the line, as for getline(3).
+ * @newline:       Set to whether the line ended with a newline.
+ *
+ * Return: the new length of the line, without the newline, or -1 at
+ * the end of input or on error.
+ */
+static ssize_t read_input_line(int fd, char **buf, size_t *buf_sz,
+			       bool *newline)
+{
+	bool seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+	size_t chunk = seekable || reads_by_line(fd) ? READ_BLOCK_SIZE : 1;
+	size_t len = 0;
+	char *nl;
+	ssize_t n;
+
+	*newline = false;
+	for (;;) {
+		if (*buf_sz - len < chunk + 1) {
+			*buf_sz = (*buf_sz + chunk + 1) * 2;
+			*buf = realloc(*buf, *buf_sz);
+		}
+
+		n = read(fd, *buf + len, chunk);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			fprintf(stderr, "read: %s\n", strerror(errno));
+			return -1;
+		}
+		if (!n)
+			break;
+
+		nl = memchr(*buf + len, '\n', n);
+		if (nl) {
+			if (seekable)
+				lseek(fd, (nl + 1) - (*buf + len + n),
+				      SEEK_CUR);
+			*newline = true;
+			len = nl - *buf;
+			break;
+		}
+		len += n;
+	}
+
+	(*buf)[len] = '\0';
+	return !len && !*newline ? -1 : (ssize_t)len;
+}
+
+/*
+ * Whether @c is an IFS character, and not escaped.  @ws selects IFS
+ * whitespace or the other IFS characters.
+ */
+static bool is_ifs(const char *ifs, char c, bool escaped, bool ws)
+{
+	return !escaped && c && strchr(ifs, c) &&
+	       (ws == (c == ' ' || c == '\t' || c == '\n'));
+}
+
+static int read_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	static const char *const default_names[] = { "REPLY", NULL };
+	const char *ifs = var_get("IFS");
+	const char *const *names;
+	bool continued = true;
+	bool newline = false;
+	bool raw = false;
+	char *line = NULL;
+	size_t line_sz = 0;
+	char *text = NULL;
+	bool *escaped = NULL;
+	size_t len = 0;
+	size_t pos = 0;
+	size_t start, end;
+	size_t i = 1;
+	ssize_t got;
+	char *value;
+
+	for (; argv[i] && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-r")) {
+			fprintf(stderr, "usage: %s [-r] [name...]\n", argv[0]);
+			return 1;
+		}
+		raw = true;
+	}
+	names = argv[i] ? &argv[i] : default_names;
+	for (i = 0; names[i]; i++) {
+		if (!var_name_valid(names[i])) {
+			fprintf(stderr, "%s: %s: not a valid identifier\n",
+				argv[0], names[i]);
+			return 1;
+		}
+	}
+	if (!ifs)
+		ifs = " \t\n";
+
+	/*
+	 * Read the line.  Unless -r was given, a backslash escapes the
+	 * next character, and a backslash-newline joins the next line.
+	 */
+	while (continued) {
+		continued = false;
+		got = read_input_line(builtin_input_fd, &line, &line_sz,
+				      &newline);
+		if (got < 0)
+			break;
+
+		text = realloc(text, len + got + 1);
+		escaped = realloc(escaped, len + got + 1);
+		for (i = 0; i < (size_t)got; i++) {
+			if (raw || line[i] != '\\') {
+				escaped[len] = false;
+				text[len++] = line[i];
+			} else if (i + 1 < (size_t)got) {
+				escaped[len] = true;
+				text[len++] = line[++i];
+			} else {
+				continued = newline;
+			}
+		}
+	}
+	if (!text) {
+		text = calloc(1, 1);
+		escaped = calloc(1, 1);
+	}
+	text[len] = '\0';
+
+	/* Split the line into the variables. */
+	for (size_t n = 0; names[n]; n++) {
+		while (pos < len && is_ifs(ifs, text[pos], escaped[pos], true))
+			pos++;
+		start = pos;
+
+		if (!names[n + 1]) {
+			/* The last variable gets the rest of the line. */
+			end = len;
+			while (end > start &&
+			       is_ifs(ifs, text[end - 1], escaped[end - 1],
+				      true))
+				end--;
+			pos = end;
+		} else {
+			while (pos < len &&
+			       !is_ifs(ifs, text[pos], escaped[pos], true) &&
+			       !is_ifs(ifs, text[pos], escaped[pos], false))
+				pos++;
+			end = pos;
+			while (pos < len &&
+			       is_ifs(ifs, text[pos], escaped[pos], true))
+				pos++;
+			if (pos < len &&
+			    is_ifs(ifs, text[pos], escaped[pos], false))
+				pos++;
+		}
+
+		value = strndup(text + start, end - start);
+		var_set(names[n], value, 0);
+		free(value);
+	}
+
+	free(line);
+	free(text);
+	free(escaped);
+
+	/* Like other shells, fail at the end of input, but still set. */
+	return newline ? 0 : 1;
+}
+
+static int source_builtin(const char *const argv[], int last_rv,
+			  bool *shell_should_exit)
+{
+	static int depth;
+	int saved_in, saved_out;
+	FILE *stream;
+	int rv;
+
+	if (!argv[1] || argv[2]) {
+		fprintf(stderr, "usage: %s file\n", argv[0]);
+		return 1;
+	}
+	if (depth >= SOURCE_MAX_DEPTH) {
+		script_print_position(stderr);
+		fprintf(stderr, "%s: %s: nested too deeply\n", argv[0],
+			argv[1]);
+		return 1;
+	}
+
+	stream = fopen(argv[1], "re");
+	if (!stream) {
+		script_print_position(stderr);
+		fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1],
+			strerror(errno));
+		return 1;
+	}
+
+	/*
+	 * The file's commands run in this shell, so any redirection of
+	 * "source" itself has to be applied to the shell's own stdio
+	 * while they run.  "source" is stateful, so this is always the
+	 * main thread, or a forked child.
+	 */
+	bout_flush();
+	fflush(stdout);
+	saved_in = swap_fd(builtin_input_fd, STDIN_FILENO);
+	saved_out = swap_fd(bout_fd(), STDOUT_FILENO);
+
+	depth++;
+	rv = run_script(stream, argv[1], last_rv, shell_command_dispatcher,
+			shell_should_exit);
+	depth--;
+
+	fflush(stdout);
+	restore_fd(saved_in, STDIN_FILENO);
+	restore_fd(saved_out, STDOUT_FILENO);
+	fclose(stream);
+	return rv;
+}
+
+static struct loaded_builtin *find_loaded_builtin(const char *name)
+{
+	for (size_t i = 0; i < n_loaded_builtins; i++) {
+		if (!strcmp(loaded_builtins[i].cmd.name, name))
+			return &loaded_builtins[i];
+	}
+	return NULL;
+}
+
+/**
+ * bench_builtin() - benchmark one or more command lines
+ *
+ * Each command line is a single argument, so a pipeline is quoted:
+ * bench -n 50 -w 3 -- "sort big | uniq" "sort -u big".
+ */
+static int bench_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	struct bench_options opts = { .runs = 10 };
+	unsigned long value;
+	size_t i = 1, n = 0;
+	char *end;
+
+	for (; argv[i] && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "--")) {
+			i++;
+			break;
+		}
+		if (!strcmp(argv[i], "-o")) {
+			opts.show_output = true;
+			continue;
+		}
+		if ((strcmp(argv[i], "-n") && strcmp(argv[i], "-w")) ||
+		    !argv[i + 1])
+			goto usage;
+		value = strtoul(argv[i + 1], &end, 10);
+		if (*end || value > UINT_MAX)
+			goto usage;
+		if (argv[i][1] == 'n')
+			opts.runs = value;
+		else
+			opts.warmup = value;
+		i++;
+	}
+
+	while (argv[i + n])
+		n++;
+	if (!n || !opts.runs)
+		goto usage;
+	return bench_run(argv + i, n, &opts);
+
+usage:
+	fprintf(stderr,
+		"usage: %s [-n runs] [-w warmup] [-o] [--] command-line...\n",
+		argv[0]);
+	return 1;
+}
+
+/**
+ * count_open_fds() - count the shell's open file descriptors
+ *
+ * Return: the number of fds, or -1 if they could not be listed.
+ */
+static int count_open_fds(void)
+{
+	DIR *dir = opendir("/proc/self/fd");
+	struct dirent *ent;
+	int n = 0;
+
+	if (!dir)
+		return -1;
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] != '.')
+			n++;
+	}
+	closedir(dir);
+
+	/* Don't count the fd for the directory itself. */
+	return n - 1;
+}
+
+static void print_histogram_json(const char *name, const uint64_t *hist)
+{
+	bout_printf("\"%s\":[", name);
+	for (size_t i = 0; i < STATS_HIST_BUCKETS; i++)
+		bout_printf("%s%" PRIu64, i ? "," : "", hist[i]);
+	bout_puts("]");
+}
+
+static void print_histogram(const char *title, const uint64_t *hist)
+{
+	char label[32];
+
+	bout_printf("%s:\n", title);
+	for (size_t i = 0; i < STATS_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		if (!i)
+			snprintf(label, sizeof(label), "< 1 us");
+		else if (i == STATS_HIST_BUCKETS - 1)
+			snprintf(label, sizeof(label), ">= %llu us",
+				 1ULL << (i - 1));
+		else
+			snprintf(label, sizeof(label), "%llu-%llu us",
+				 1ULL << (i - 1), 1ULL << i);
+		bout_printf("  %18s  %" PRIu64 "\n", label, hist[i]);
+	}
+}
+
+static void print_cache_rate(const char *title, uint64_t hits,
+			     uint64_t misses)
+{
+	bout_printf("%-22s%" PRIu64 " hits, %" PRIu64 " misses", title,
+		    hits, misses);
+	if (hits + misses)
+		bout_printf(" (%.1f%% hit)", 100.0 * hits / (hits + misses));
+	bout_puts("\n");
+}
+
+/**
+ * shellstats_builtin() - print the shell's internal counters
+ *
+ * The counters are summed across every thread which has run a
+ * builtin.  Work done in forked children is not counted.  With -j,
+ * they are printed as a single line of JSON.
+ */
+static int shellstats_builtin(const char *const argv[], int last_rv,
+			      bool *unused)
+{
+	struct shell_stats st;
+	bool json = false;
+
+	if (argv[1] && !strcmp(argv[1], "-j")) {
+		json = true;
+		argv++;
+	}
+	if (argv[1]) {
+		fprintf(stderr, "usage: shellstats [-j]\n");
+		return 1;
+	}
+
+	stats_collect(&st);
+	if (json) {
+		bout_printf("{\"commands\":%" PRIu64 ",\"forks\":%" PRIu64
+			    ",\"execs\":%" PRIu64 ",\"builtin_runs\":%" PRIu64
+			    ",\"builtin_threads\":%" PRIu64
+			    ",\"wait_ns\":%" PRIu64,
+			    st.commands, st.forks, st.execs, st.builtin_runs,
+			    st.builtin_threads, st.wait_ns);
+		bout_printf(",\"path_cache\":{\"hits\":%" PRIu64
+			    ",\"misses\":%" PRIu64 "}"
+			    ",\"cdpath_cache\":{\"hits\":%" PRIu64
+			    ",\"misses\":%" PRIu64 "}"
+			    ",\"memo\":{\"hits\":%" PRIu64
+			    ",\"misses\":%" PRIu64 "},\"open_fds\":%d,",
+			    st.path_cache_hits, st.path_cache_misses,
+			    st.cdpath_cache_hits, st.cdpath_cache_misses,
+			    st.memo_hits, st.memo_misses, count_open_fds());
+		print_histogram_json("parse_us_log2", st.parse_hist);
+		bout_puts(",");
+		print_histogram_json("spawn_us_log2", st.spawn_hist);
+		bout_puts("}\n");
+		return 0;
+	}
+
+	bout_printf("%-22s%" PRIu64 "\n", "commands", st.commands);
+	bout_printf("%-22s%" PRIu64 "\n", "forks", st.forks);
+	bout_printf("%-22s%" PRIu64 "\n", "execs", st.execs);
+	bout_printf("%-22s%" PRIu64 " (%" PRIu64 " on threads)\n",
+		    "builtin runs", st.builtin_runs, st.builtin_threads);
+	bout_printf("%-22s%.3f ms\n", "wait time", st.wait_ns / 1e6);
+	print_cache_rate("path cache", st.path_cache_hits,
+			 st.path_cache_misses);
+	print_cache_rate("cdpath cache", st.cdpath_cache_hits,
+			 st.cdpath_cache_misses);
+	print_cache_rate("memo", st.memo_hits, st.memo_misses);
+	bout_printf("%-22s%d\n", "open fds", count_open_fds());
+	print_histogram("parse time", st.parse_hist);
+	print_histogram("spawn latency", st.spawn_hist);
+	return 0;
+}
+
+static void memo_usage_error(void)
+{
+	fprintf(stderr,
+		"usage: memo [-i] [-e var] [-f file] [-m file] [--] command [arg...]\n"
+		"       memo stats | clear\n");
+}
+
+static int memo_stats(void)
+{
+	struct shell_stats st;
+	uint64_t entries, bytes;
+	const char *path;
+
+	stats_collect(&st);
+	path = memo_usage(&entries, &bytes);
+	bout_printf("hits      %" PRIu64 "\n", st.memo_hits);
+	bout_printf("misses    %" PRIu64 "\n", st.memo_misses);
+	bout_printf("entries   %" PRIu64 "\n", entries);
+	bout_printf("size      %" PRIu64 " bytes (limit %" PRIu64 ")\n", bytes,
+		    memo_max_size());
+	bout_printf("store     %s\n", path ? path : "(none)");
+	return 0;
+}
+
+/**
+ * memo_builtin() - replay a command's output from the memo store
+ *
+ * The options declare the inputs the command depends on, besides its
+ * arguments and the current directory: -e for an environment
+ * variable, -f for a file's contents and -m for a file's size and
+ * mtime.  Each may be given any number of times.  Piped or redirected
+ * input counts too, unless it is a terminal, and -i makes the input
+ * count even when it is the shell's own.  Otherwise, it is left for
+ * the shell to read the rest of its script from.  "memo stats" and
+ * "memo clear" report on and empty the store.  To memoize a command
+ * called "stats" or "clear", put "--" before it.
+ */
+static int memo_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	struct memo_inputs inputs = { 0 };
+	const char **lists;
+	size_t argc = 0;
+	size_t i = 1;
+	int rv;
+
+	if (argv[1] && !argv[2] && !strcmp(argv[1], "stats"))
+		return memo_stats();
+	if (argv[1] && !argv[2] && !strcmp(argv[1], "clear")) {
+		if (memo_clear() < 0) {
+			fprintf(stderr, "memo: clear: %s\n", strerror(errno));
+			return 1;
+		}
+		return 0;
+	}
+
+	while (argv[argc])
+		argc++;
+	lists = malloc(3 * argc * sizeof(*lists));
+	inputs.env_names = lists;
+	inputs.content_files = lists + argc;
+	inputs.mtime_files = lists + 2 * argc;
+	inputs.standard_input = builtin_input_redirected &&
+				!isatty(builtin_input_fd);
+
+	for (; argv[i] && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "--")) {
+			i++;
+			break;
+		}
+		if (argv[i][1] && argv[i][2])
+			goto usage;
+		if (argv[i][1] == 'i') {
+			inputs.standard_input = true;
+			continue;
+		}
+		if (!argv[i + 1])
+			goto usage;
+
+		switch (argv[i][1]) {
+		case 'e':
+			inputs.env_names[inputs.n_env_names++] = argv[++i];
+			break;
+		case 'f':
+			inputs.content_files[inputs.n_content_files++] =
+				argv[++i];
+			break;
+		case 'm':
+			inputs.mtime_files[inputs.n_mtime_files++] = argv[++i];
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (!argv[i])
+		goto usage;
+
+	rv = memo_run(argv + i, builtin_envp ? builtin_envp : var_envp(),
+		      &inputs);
+	free(lists);
+	return rv;
+
+usage:
+	memo_usage_error();
+	free(lists);
+	return 1;
+}
+
+/**
+ * parallel_builtin() - run a command for each item, several at a time
+ *
+ * The items are the arguments after ":::", or else the lines of the
+ * input.  -j sets how many jobs run at once, and defaults to the
+ * number of online CPUs.  --halt sets what happens when a job fails,
+ * as described in parallel.h.
+ */
+static int parallel_builtin(const char *const argv[], int last_rv,
+			    bool *unused)
+{
+	struct parallel_options opts = { .halt = PARALLEL_HALT_NEVER };
+	const char **template;
+	const char *const *items = NULL;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t i = 1, n = 0, n_items;
+	char *end;
+	int rv;
+
+	opts.max_jobs = ncpus > 0 ? ncpus : 1;
+	for (; argv[i] && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "--")) {
+			i++;
+			break;
+		}
+		if (!argv[i + 1])
+			goto usage;
+		if (!strcmp(argv[i], "-j")) {
+			opts.max_jobs = strtoul(argv[++i], &end, 10);
+			if (*end || !opts.max_jobs)
+				goto usage;
+			if (opts.max_jobs > PARALLEL_MAX_JOBS) {
+				fprintf(stderr, "%s: -j: at most %d jobs\n",
+					argv[0], PARALLEL_MAX_JOBS);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--halt")) {
+			i++;
+			if (!strcmp(argv[i], "never"))
+				opts.halt = PARALLEL_HALT_NEVER;
+			else if (!strcmp(argv[i], "soon"))
+				opts.halt = PARALLEL_HALT_SOON;
+			else if (!strcmp(argv[i], "now"))
+				opts.halt = PARALLEL_HALT_NOW;
+			else
+				goto usage;
+		} else {
+			goto usage;
+		}
+	}
+
+	while (argv[i + n] && strcmp(argv[i + n], ":::"))
+		n++;
+	if (!n)
+		goto usage;
+	if (argv[i + n]) {
+		items = argv + i + n + 1;
+		/* More jobs than items would never run. */
+		for (n_items = 0; items[n_items]; n_items++)
+			;
+		if (n_items && opts.max_jobs > n_items)
+			opts.max_jobs = n_items;
+	}
+
+	template = malloc((n + 1) * sizeof(*template));
+	memcpy(template, argv + i, n * sizeof(*template));
+	template[n] = NULL;
+	rv = parallel_run(template, items, &opts);
+	free(template);
+	return rv;
+
+usage:
+	fprintf(stderr,
+		"usage: %s [-j jobs] [--halt never | soon | now] [--] command "
+		"[arg...] [::: item...]\n",
+		argv[0]);
+	return 1;
+}
+
+static const struct {
+	const char *name;
+	int sig;
+} signal_names[] = {
+	{ "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+	{ "ILL", SIGILL }, { "TRAP", SIGTRAP }, { "ABRT", SIGABRT },
+	{ "BUS", SIGBUS }, { "FPE", SIGFPE }, { "KILL", SIGKILL },
+	{ "USR1", SIGUSR1 }, { "SEGV", SIGSEGV }, { "USR2", SIGUSR2 },
+	{ "PIPE", SIGPIPE }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+	{ "CHLD", SIGCHLD }, { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+	{ "TSTP", SIGTSTP }, { "TTIN", SIGTTIN }, { "TTOU", SIGTTOU },
+	{ "URG", SIGURG }, { "XCPU", SIGXCPU }, { "XFSZ", SIGXFSZ },
+	{ "VTALRM", SIGVTALRM }, { "PROF", SIGPROF }, { "WINCH", SIGWINCH },
+	{ "IO", SIGIO }, { "SYS", SIGSYS },
+};
+
+/**
+ * parse_signal() - look up a signal by number, or by name with or
+ * without "SIG", in any case
+ *
+ * Return: the signal, or -1 if there is none.
+ */
+static int parse_signal(const char *name)
+{
+	char *end;
+	long sig = strtol(name, &end, 10);
+
+	if (end != name && !*end)
+		return sig >= 0 && sig < NSIG ? sig : -1;
+
+	if (!strncasecmp(name, "SIG", 3))
+		name += 3;
+	for (size_t i = 0; i < ARRAY_SIZE(signal_names); i++) {
+		if (!strcasecmp(name, signal_names[i].name))
+			return signal_names[i].sig;
+	}
+	return -1;
+}
+
+/**
+ * list_signals() - print the signal names, or translate @args
+ *
+ * A number, or an exit status of a process killed by a signal, is
+ * translated to the signal's name, and a name to its number.
+ */
+static int list_signals(const char *const args[])
+{
+	int rv = 0;
+	int sig;
+
+	if (!*args) {
+		for (size_t i = 0; i < ARRAY_SIZE(signal_names); i++)
+			bout_printf("%2d) SIG%s\n", signal_names[i].sig,
+				    signal_names[i].name);
+		return 0;
+	}
+
+	for (; *args; args++) {
+		if (isdigit(**args)) {
+			sig = atoi(*args);
+			if (sig > 128)
+				sig -= 128;
+		} else {
+			sig = parse_signal(*args);
+		}
+		for (size_t i = 0; sig > 0 && i < ARRAY_SIZE(signal_names);
+		     i++) {
+			if (signal_names[i].sig != sig)
+				continue;
+			if (isdigit(**args))
+				bout_printf("%s\n", signal_names[i].name);
+			else
+				bout_printf("%d\n", sig);
+			sig = 0;
+		}
+		if (sig) {
+			fprintf(stderr, "kill: %s: invalid signal specification\n",
+				*args);
+			rv = 1;
+		}
+	}
+	return rv;
+}
+
+/**
+ * kill_builtin() - send a signal to jobs or processes
+ *
+ * The signal is given as "-s SIG", "-n NUM" or "-SIG", and defaults
+ * to SIGTERM.  Targets are pids or job specs, as described in jobs.h.
+ * -g signals every process in the job of each pid, so the whole of a
+ * pipeline is signalled at once.  "kill -l" lists the signals.
+ */
+static int kill_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	int sig = SIGTERM;
+	bool group = false;
+	size_t i = 1;
+	int rv = 0;
+
+	for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (!strcmp(argv[i], "--")) {
+			i++;
+			break;
+		}
+		if (!strcmp(argv[i], "-l"))
+			return list_signals(argv + i + 1);
+		if (!strcmp(argv[i], "-g")) {
+			group = true;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "-n")) {
+			if (!argv[++i])
+				goto usage;
+			sig = parse_signal(argv[i]);
+		} else {
+			sig = parse_signal(argv[i] + 1);
+		}
+		if (sig < 0) {
+			fprintf(stderr, "%s: %s: invalid signal specification\n",
+				argv[0], argv[i]);
+			return 1;
+		}
+	}
+	if (!argv[i])
+		goto usage;
+
+	for (; argv[i]; i++) {
+		if (jobs_signal(argv[i], sig, group) < 0)
+			rv = 1;
+	}
+	return rv;
+
+usage:
+	fprintf(stderr,
+		"usage: %s [-s signal | -n num | -signal] [-g] pid | %%job...\n"
+		"       %s -l [signal | status...]\n",
+		argv[0], argv[0]);
+	return 1;
+}
+
+/**
+ * jobs_builtin() - list the background jobs, with their pids with -l
+ */
+static int jobs_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	bool show_pids = argv[1] && !strcmp(argv[1], "-l");
+
+	if (argv[1 + show_pids]) {
+		fprintf(stderr, "usage: %s [-l]\n", argv[0]);
+		return 1;
+	}
+	jobs_print(show_pids);
+	return 0;
+}
+
+/**
+ * trace_builtin() - dump the phase trace, or clear it with -c
+ *
+ * The trace is written as Chrome trace JSON, for Perfetto or
+ * chrome://tracing, so "trace > session.json" saves it to load there.
+ */
+static int trace_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	bool clear = argv[1] && !strcmp(argv[1], "-c");
+
+	if (argv[1 + clear]) {
 		fprintf(stderr, "usage: %s [-c]\n", argv[0]);
+		return 1;
+	}
+	if (clear)
+		trace_clear();
+	else
+		trace_dump();
+	return 0;
+}
+
+/**
+ * load_builtin() - load the builtin @name from the shared object @path
+ *
+ * The shared object must define a "struct builtin_command" named
+ * "@name_builtin" (e.g. "hello_builtin" for "hello").
+ *
+ * Return: zero on success, or -1 on failure.
+ */
+static int load_builtin(const char *path, const char *name)
+{
+	struct loaded_builtin loaded;
+	const struct builtin_command *cmd;
+	char *symbol;
+	void *handle;
+
+	if (find_builtin(name)) {
+		fprintf(stderr, "enable: %s: already a builtin\n", name);
 		return -1;
 	}
 
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		fprintf(stderr, "enable: %s\n", dlerror());
+		return -1;
+	}
+
+	symbol = malloc(strlen(name) + sizeof("_builtin"));
+	sprintf(symbol, "%s_builtin", name);
+	cmd = dlsym(handle, symbol);
+	free(symbol);
+	if (!cmd || !cmd->handler || !cmd->name || strcmp(cmd->name, name)) {
+		fprintf(stderr, "enable: %s: no builtin %s in %s\n", name,
+			name, path);
+		dlclose(handle);
+		return -1;
+	}
+
+	loaded.cmd = *cmd;
+	loaded.handle = handle;
+	loaded.path = strdup(path);
+	loaded_builtins = realloc(loaded_builtins, (n_loaded_builtins + 1) *
+							   sizeof(*loaded_builtins));
+	loaded_builtins[n_loaded_builtins++] = loaded;
+	return 0;
+}
+
+static int unload_builtin(const char *name)
+{
+	struct loaded_builtin *loaded = find_loaded_builtin(name);
+
+	if (!loaded) {
+		fprintf(stderr, "enable: %s: not a loaded builtin\n", name);
+		return -1;
+	}
+
+	dlclose(loaded->handle);
+	free(loaded->path);
+	*loaded = loaded_builtins[--n_loaded_builtins];
 	return 0;
 }
 
+static int enable_builtin(const char *const argv[], int last_rv, bool *unused)
+{
+	int rv = 0;
+
+	if (!argv[1]) {
+		for (size_t i = 0; i < n_loaded_builtins; i++)
+			bout_printf("enable -f %s %s\n",
+				    loaded_builtins[i].path,
+				    loaded_builtins[i].cmd.name);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "-f") && argv[2] && argv[3]) {
+		for (size_t i = 3; argv[i]; i++)
+			rv |= load_builtin(argv[2], argv[i]) < 0;
+		return rv;
+	}
+
+	if (!strcmp(argv[1], "-d") && argv[2]) {
+		for (size_t i = 2; argv[i]; i++)
+			rv |= unload_builtin(argv[i]) < 0;
+		return rv;
+	}
+
+	fprintf(stderr, "usage: %s [-f file name... | -d name...]\n", argv[0]);
+	return 1;
+}
+
 struct builtin_command builtin_commands[] = {
-	{ "cd", cd_builtin },
-	{ "exit", exit_builtin },
+	{ ".", source_builtin, BUILTIN_STATEFUL },
+	{ "[", test_builtin },
+	{ "bench", bench_builtin, BUILTIN_STATEFUL },
+	{ "cd", cd_builtin, BUILTIN_STATEFUL },
+	{ "command", command_builtin, BUILTIN_STATEFUL },
+	{ "echo", echo_builtin },
+	{ "enable", enable_builtin, BUILTIN_STATEFUL },
+	{ "env", env_builtin },
+	{ "exec", exec_builtin,
+	  BUILTIN_STATEFUL | BUILTIN_PERSISTENT_REDIRECTIONS },
+	{ "exit", exit_builtin, BUILTIN_STATEFUL },
+	{ "export", export_builtin, BUILTIN_STATEFUL },
 	{ "help", help_builtin },
-	{ "history", history_builtin },
+	{ "history", history_builtin, BUILTIN_STATEFUL },
+	{ "jobs", jobs_builtin },
+	{ "kill", kill_builtin },
+	{ "memo", memo_builtin },
+	{ "parallel", parallel_builtin },
+	{ "printf", printf_builtin },
+	{ "read", read_builtin, BUILTIN_STATEFUL },
+	{ "set", set_builtin, BUILTIN_STATEFUL },
+	{ "shellstats", shellstats_builtin },
+	{ "source", source_builtin, BUILTIN_STATEFUL },
+	{ "test", test_builtin },
+	{ "trace", trace_builtin },
+	{ "type", type_builtin },
+	{ "unset", unset_builtin, BUILTIN_STATEFUL },
+	{ "which", which_builtin },
 	{ NULL },
 };
+
+_Static_assert(ARRAY_SIZE(builtin_commands) == BUILTIN_HASH_COUNT + 1,
+	       "builtin_hash.h is out of date");
+
+const struct builtin_command *find_builtin(const char *name)
+{
+	int i = builtin_hash_slots[strhash(name, BUILTIN_HASH_SEED) &
+				   (BUILTIN_HASH_SIZE - 1)];
+	struct loaded_builtin *loaded;
+
+	if (i >= 0 && !strcmp(builtin_commands[i].name, name))
+		return &builtin_commands[i];
+
+	loaded = find_loaded_builtin(name);
+	return loaded ? &loaded->cmd : NULL;
+}
@@ -0,0 +1,84 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+/* A thread's counters, in the list of live threads. */
+struct stats_slot {
+	struct shell_stats stats;
+	struct stats_slot *next;
+};
+
+_Thread_local struct shell_stats *stats_local;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_slot *live_slots;
+
+/* The sums of the counters of threads which have exited. */
+static struct shell_stats retired;
+
+/* Every field of struct shell_stats is a uint64_t counter. */
+#define STATS_N_COUNTERS (sizeof(struct shell_stats) / sizeof(uint64_t))
+
+static void add_counters(struct shell_stats *total,
+			 const struct shell_stats *stats)
+{
+	uint64_t *dst = (uint64_t *)total;
+	const uint64_t *src = (const uint64_t *)stats;
+
+	for (size_t i = 0; i < STATS_N_COUNTERS; i++)
+		dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+struct shell_stats *stats_register(void)
+{
+	struct stats_slot *slot;
+
+	slot = aligned_alloc(_Alignof(struct stats_slot), sizeof(*slot));
+	memset(slot, 0, sizeof(*slot));
+
+	pthread_mutex_lock(&stats_lock);
+	slot->next = live_slots;
+	live_slots = slot;
+	pthread_mutex_unlock(&stats_lock);
+
+	stats_local = &slot->stats;
+	return stats_local;
+}
+
+void stats_thread_exit(void)
+{
+	struct stats_slot **link;
+	struct stats_slot *slot;
+
+	if (!stats_local)
+		return;
+
+	pthread_mutex_lock(&stats_lock);
+	for (link = &live_slots; *link; link = &(*link)->next) {
+		slot = *link;
+		if (&slot->stats == stats_local) {
+			*link = slot->next;
+			add_counters(&retired, &slot->stats);
+			free(slot);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&stats_lock);
+	stats_local = NULL;
+}
+
+void stats_collect(struct shell_stats *total)
+{
+	memset(total, 0, sizeof(*total));
+
+	pthread_mutex_lock(&stats_lock);
+	add_counters(total, &retired);
+	for (struct stats_slot *slot = live_slots; slot; slot = slot->next)
+		add_counters(total, &slot->stats);
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+
+struct trace_event {
+	/* The index the span was recorded at plus one, once complete. */
+	uint64_t seq;
+	uint64_t start_ns;
+	uint64_t dur_ns;
+	const char *name;
+	const char *arg_name;
+	long arg;
+	pid_t pid;
+	pid_t tid;
+	char detail[TRACE_DETAIL_MAX];
+};
+
+struct trace_ring {
+	/* The index of the next span to record. */
+	uint64_t head;
+	/* The index of the first span to dump, set by trace_clear(). */
+	uint64_t first;
+	struct trace_event events[TRACE_RING_SIZE] __attribute__((aligned(64)));
+};
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0,
+	       "TRACE_RING_SIZE must be a power of two");
+
+static struct trace_ring *ring;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+/* This thread's ids, or zero until they are first needed. */
+static _Thread_local pid_t trace_pid, trace_tid;
+
+/* A forked child is a new process, with only the forking thread. */
+static void forget_ids(void)
+{
+	trace_pid = 0;
+	trace_tid = 0;
+}
+
+static void ring_init(void)
+{
+	void *p = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		return;
+	ring = p;
+	pthread_atfork(NULL, NULL, forget_ids);
+}
+
+void trace_span(const char *name, uint64_t start_ns, const char *detail,
+		const char *arg_name, long arg)
+{
+	uint64_t end_ns = stats_now_ns();
+	struct trace_event *ev;
+	uint64_t index;
+
+	pthread_once(&ring_once, ring_init);
+	if (!ring)
+		return;
+	if (!trace_tid) {
+		trace_pid = getpid();
+		trace_tid = gettid();
+	}
+
+	index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+	ev = &ring->events[index & (TRACE_RING_SIZE - 1)];
+
+	/* Readers must not see a half-written span as the old one. */
+	__atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	ev->start_ns = start_ns;
+	ev->dur_ns = end_ns - start_ns;
+	ev->name = name;
+	ev->arg_name = arg_name;
+	ev->arg = arg;
+	ev->pid = trace_pid;
+	ev->tid = trace_tid;
+	if (detail)
+		strncpy(ev->detail, detail, sizeof(ev->detail) - 1);
+	ev->detail[detail ? sizeof(ev->detail) - 1 : 0] = '\0';
+
+	__atomic_store_n(&ev->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * read_event() - copy the span recorded at @index, if it is still there
+ *
+ * Return: true if @out holds the span, or false if it was overwritten,
+ * or is still being written.
+ */
+static bool read_event(uint64_t index, struct trace_event *out)
+{
+	struct trace_event *ev = &ring->events[index & (TRACE_RING_SIZE - 1)];
+
+	if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != index + 1)
+		return false;
+	memcpy(out, ev, sizeof(*out));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&ev->seq, __ATOMIC_RELAXED) == index + 1;
+}
+
+static void print_json_string(const char *str)
+{
+	bout_puts("\"");
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			bout_printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			bout_printf("\\u%04x", *str);
+		else
+			bout_printf("%c", *str);
+	}
+	bout_puts("\"");
+}
+
+void trace_dump(void)
+{
+	struct trace_event ev;
+	uint64_t head, first;
+	bool comma = false;
+
+	bout_puts("{\"traceEvents\":[");
+	pthread_once(&ring_once, ring_init);
+	if (ring) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		first = __atomic_load_n(&ring->first, __ATOMIC_RELAXED);
+		if (head - first > TRACE_RING_SIZE)
+			first = head - TRACE_RING_SIZE;
+	} else {
+		head = first = 0;
+	}
+
+	for (uint64_t i = first; i < head; i++) {
+		if (!read_event(i, &ev))
+			continue;
+		bout_printf("%s\n{\"name\":\"%s\",\"cat\":\"shell\",\"ph\":\"X\","
+			    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+			    "\"args\":{",
+			    comma ? "," : "", ev.name, ev.start_ns / 1e3,
+			    ev.dur_ns / 1e3, ev.pid, ev.tid);
+		if (ev.detail[0]) {
+			bout_puts("\"detail\":");
+			print_json_string(ev.detail);
+		}
+		if (ev.arg_name)
+			bout_printf("%s\"%s\":%ld", ev.detail[0] ? "," : "",
+				    ev.arg_name, ev.arg);
+		bout_puts("}}");
+		comma = true;
+	}
+	bout_puts("\n],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+void trace_clear(void)
+{
+	pthread_once(&ring_once, ring_init);
+	if (ring)
+		__atomic_store_n(&ring->first,
+				 __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE),
+				 __ATOMIC_RELAXED);
+}
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "strhash.h"
+#include "variables.h"
+
+struct variable {
+	/* The next variable in the same hash bucket. */
+	struct variable *next;
+
+	/*
+	 * "NAME=VALUE", exactly as placed in the environment.  The
+	 * value starts at entry + name_len + 1.
+	 */
+	char *entry;
+	size_t name_len;
+
+	/* The index of the entry in envp, or -1 if not exported. */
+	ssize_t envp_index;
+};
+
+/* A chained hash table, which doubles in size when full. */
+static struct variable **buckets;
+static size_t n_buckets;
+static size_t n_variables;
+
+/*
+ * The exported entries, NULL-terminated, and the variable owning
+ * each one.
+ */
+static char **envp;
+static struct variable **envp_vars;
+static size_t envp_len;
+static size_t envp_cap;
+
+void (*var_change_hook)(const char *name, const char *value, bool exported);
+
+bool var_name_valid(const char *name)
+{
+	if (!(*name == '_' || (*name >= 'A' && *name <= 'Z') ||
+	      (*name >= 'a' && *name <= 'z')))
+		return false;
+	for (name++; *name; name++) {
+		if (!(*name == '_' || (*name >= 'A' && *name <= 'Z') ||
+		      (*name >= 'a' && *name <= 'z') ||
+		      (*name >= '0' && *name <= '9')))
+			return false;
+	}
+	return true;
+}
+
+static const char *var_value(const struct variable *var)
+{
+	return var->entry + var->name_len + 1;
+}
+
+static struct variable **bucket_of(const char *name)
+{
+	return &buckets[strhash(name, 0) & (n_buckets - 1)];
+}
+
+static void grow_table(void)
+{
+	struct variable **old = buckets;
+	size_t old_n = n_buckets;
+	struct variable *var, *next;
+	struct variable **bucket;
+
+	n_buckets = n_buckets ? n_buckets * 2 : 64;
+	buckets = calloc(n_buckets, sizeof(*buckets));
+
+	for (size_t i = 0; i < old_n; i++) {
+		for (var = old[i]; var; var = next) {
+			next = var->next;
+			var->entry[var->name_len] = '\0';
+			bucket = bucket_of(var->entry);
+			var->entry[var->name_len] = '=';
+			var->next = *bucket;
+			*bucket = var;
+		}
+	}
+	free(old);
+}
+
+static struct variable **find_var(const char *name)
+{
+	size_t len = strlen(name);
+	struct variable **link;
+
+	for (link = bucket_of(name); *link; link = &(*link)->next) {
+		if ((*link)->name_len == len &&
+		    !memcmp((*link)->entry, name, len))
+			return link;
+	}
+	return link;
+}
+
+static void envp_add(struct variable *var)
+{
+	if (envp_len + 1 >= envp_cap) {
+		envp_cap *= 2;
+		envp = realloc(envp, envp_cap * sizeof(*envp));
+		envp_vars = realloc(envp_vars, envp_cap * sizeof(*envp_vars));
+	}
+	var->envp_index = envp_len;
+	envp[envp_len] = var->entry;
+	envp_vars[envp_len] = var;
+	envp[++envp_len] = NULL;
+}
+
+static void envp_remove(struct variable *var)
+{
+	size_t i = var->envp_index;
+
+	/* Move the last entry into the hole. */
+	envp_len--;
+	envp[i] = envp[envp_len];
+	envp_vars[i] = envp_vars[envp_len];
+	envp_vars[i]->envp_index = i;
+	envp[envp_len] = NULL;
+	var->envp_index = -1;
+}
+
+static void notify(const struct variable *var, const char *name)
+{
+	if (var_change_hook)
+		var_change_hook(name, var ? var_value(var) : NULL,
+				var && var->envp_index >= 0);
+}
+
+static void set_var(const char *name, const char *value, int flags)
+{
+	struct variable **link = find_var(name);
+	struct variable *var = *link;
+	size_t name_len = strlen(name);
+	size_t value_len = strlen(value);
+	char *entry;
+
+	entry = malloc(name_len + value_len + 2);
+	memcpy(entry, name, name_len);
+	entry[name_len] = '=';
+	memcpy(entry + name_len + 1, value, value_len + 1);
+
+	if (var) {
+		free(var->entry);
+		var->entry = entry;
+		if (var->envp_index >= 0)
+			envp[var->envp_index] = entry;
+	} else {
+		var = calloc(1, sizeof(*var));
+		var->entry = entry;
+		var->name_len = name_len;
+		var->envp_index = -1;
+		*link = var;
+		n_variables++;
+	}
+	if ((flags & VAR_EXPORT) && var->envp_index < 0)
+		envp_add(var);
+}
+
+/*
+ * Fill the table from the environment the shell started with, the
+ * first time it is used.
+ */
+static void init_vars(void)
+{
+	extern char **environ;
+	char *name;
+	char *eq;
+
+	if (buckets)
+		return;
+	grow_table();
+	envp_cap = 64;
+	envp = malloc(envp_cap * sizeof(*envp));
+	envp_vars = malloc(envp_cap * sizeof(*envp_vars));
+	envp[0] = NULL;
+
+	for (char **env = environ; *env; env++) {
+		eq = strchr(*env, '=');
+		if (!eq)
+			continue;
+		name = strndup(*env, eq - *env);
+		if (var_name_valid(name) && !*find_var(name)) {
+			if (n_variables >= n_buckets)
+				grow_table();
+			set_var(name, eq + 1, VAR_EXPORT);
+		}
+		free(name);
+	}
+}
+
+const char *var_get(const char *name)
+{
+	struct variable *var;
+
+	init_vars();
+	var = *find_var(name);
+	return var ? var_value(var) : NULL;
+}
+
+int var_set(const char *name, const char *value, int flags)
+{
+	init_vars();
+	if (!var_name_valid(name))
+		return -1;
+	if (n_variables >= n_buckets)
+		grow_table();
+	set_var(name, value, flags);
+	notify(*find_var(name), name);
+	return 0;
+}
+
+int var_export(const char *name, bool exported)
+{
+	struct variable *var;
+
+	init_vars();
+	if (!var_name_valid(name))
+		return -1;
+	var = *find_var(name);
+	if (!var || exported == (var->envp_index >= 0))
+		return 0;
+
+	if (exported)
+		envp_add(var);
+	else
+		envp_remove(var);
+	notify(var, name);
+	return 0;
+}
+
+int var_unset(const char *name)
+{
+	struct variable **link;
+	struct variable *var;
+
+	init_vars();
+	if (!var_name_valid(name))
+		return -1;
+	link = find_var(name);
+	var = *link;
+	if (!var)
+		return 0;
+
+	if (var->envp_index >= 0)
+		envp_remove(var);
+	*link = var->next;
+	free(var->entry);
+	free(var);
+	n_variables--;
+	notify(NULL, name);
+	return 0;
+}
+
+char *const *var_envp(void)
+{
+	init_vars();
+	return envp;
+}
+
+char **var_envp_with(char *const assignments[])
+{
+	struct variable *var;
+	size_t n_assignments = 0;
+	size_t name_len;
+	size_t len;
+	char **result;
+	char *name;
+	size_t j;
+
+	init_vars();
+	while (assignments[n_assignments])
+		n_assignments++;
+	result = malloc((envp_len + n_assignments + 1) * sizeof(*result));
+	memcpy(result, envp, envp_len * sizeof(*result));
+	len = envp_len;
+
+	for (size_t i = 0; i < n_assignments; i++) {
+		name_len = strcspn(assignments[i], "=");
+		name = strndup(assignments[i], name_len);
+		var = *find_var(name);
+		free(name);
+		if (var && var->envp_index >= 0) {
+			result[var->envp_index] = assignments[i];
+			continue;
+		}
+
+		/* A later assignment to the same name wins. */
+		for (j = envp_len; j < len; j++) {
+			if (!strncmp(result[j], assignments[i], name_len + 1))
+				break;
+		}
+		result[j] = assignments[i];
+		if (j == len)
+			len++;
+	}
+
+	result[len] = NULL;
+	return result;
+}
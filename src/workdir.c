@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "strhash.h"
+#include "variables.h"
+#include "workdir.h"
+
+#define CDPATH_CACHE_BUCKETS 64
+
+/* The logical current directory, or NULL until it is first needed. */
+static char *cwd;
+
+/*
+ * A directory as it was when a name was looked for in it.  While its
+ * identity and mtime are the same, it cannot have gained the name.
+ */
+struct dir_id {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+};
+
+/*
+ * The CDPATH entry each name was found in, with the entries before it
+ * as they were then.  Only cd uses this, and it always runs on the
+ * shell's main thread, so there is no lock.
+ */
+struct cdpath_entry {
+	struct cdpath_entry *next;
+	char *name;
+	char *dir;
+	struct dir_id *before;
+	size_t n_before;
+};
+
+static struct cdpath_entry *buckets[CDPATH_CACHE_BUCKETS];
+
+/* The CDPATH the cached entries were found in. */
+static char *cached_cdpath_var;
+
+/**
+ * canonicalize() - remove ".", ".." and repeated slashes from a path
+ *
+ * This is purely textual, so ".." removes the previous component
+ * even when it is a symbolic link.
+ *
+ * @path:   An absolute path.
+ *
+ * Return: the newly allocated path.
+ */
+static char *canonicalize(const char *path)
+{
+	char *out = malloc(strlen(path) + 2);
+	size_t len = 0;
+	size_t n;
+
+	for (;;) {
+		path += strspn(path, "/");
+		n = strcspn(path, "/");
+		if (!n)
+			break;
+
+		if (n == 2 && path[0] == '.' && path[1] == '.') {
+			while (len && out[--len] != '/')
+				;
+		} else if (n != 1 || path[0] != '.') {
+			out[len++] = '/';
+			memcpy(out + len, path, n);
+			len += n;
+		}
+		path += n;
+	}
+
+	if (!len)
+		out[len++] = '/';
+	out[len] = '\0';
+	return out;
+}
+
+static bool same_file(const char *a, const char *b)
+{
+	struct stat st_a, st_b;
+
+	return !stat(a, &st_a) && !stat(b, &st_b) &&
+	       st_a.st_dev == st_b.st_dev && st_a.st_ino == st_b.st_ino;
+}
+
+static void set_cwd(char *path)
+{
+	if (cwd)
+		var_set("OLDPWD", cwd, VAR_EXPORT);
+	free(cwd);
+	cwd = path;
+	var_set("PWD", cwd, VAR_EXPORT);
+}
+
+const char *workdir_get(void)
+{
+	const char *pwd;
+	char *canon;
+
+	if (cwd)
+		return cwd;
+
+	pwd = var_get("PWD");
+	if (pwd && pwd[0] == '/') {
+		canon = canonicalize(pwd);
+		if (!strcmp(canon, pwd) && same_file(canon, ".")) {
+			set_cwd(canon);
+			return cwd;
+		}
+		free(canon);
+	}
+
+	canon = getcwd(NULL, 0);
+	if (canon)
+		set_cwd(canon);
+	return cwd;
+}
+
+int workdir_change(const char *dir, bool physical)
+{
+	const char *base = workdir_get();
+	char *joined, *path;
+
+	if (physical || (!base && dir[0] != '/')) {
+		if (chdir(dir) < 0)
+			return -1;
+		path = getcwd(NULL, 0);
+		if (!path)
+			return -1;
+		set_cwd(path);
+		return 0;
+	}
+
+	if (dir[0] == '/') {
+		path = canonicalize(dir);
+	} else {
+		if (asprintf(&joined, "%s/%s", base, dir) < 0)
+			return -1;
+		path = canonicalize(joined);
+		free(joined);
+	}
+
+	if (chdir(path) < 0) {
+		free(path);
+		return -1;
+	}
+	set_cwd(path);
+	return 0;
+}
+
+static bool is_directory(const char *path)
+{
+	struct stat st;
+
+	return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+static void clear_cache(void)
+{
+	struct cdpath_entry *entry, *next;
+
+	for (size_t i = 0; i < CDPATH_CACHE_BUCKETS; i++) {
+		for (entry = buckets[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry->name);
+			free(entry->dir);
+			free(entry->before);
+			free(entry);
+		}
+		buckets[i] = NULL;
+	}
+	free(cached_cdpath_var);
+	cached_cdpath_var = NULL;
+}
+
+static struct cdpath_entry **find_entry(const char *name)
+{
+	struct cdpath_entry **link;
+
+	link = &buckets[strhash(name, 0) % CDPATH_CACHE_BUCKETS];
+	for (; *link; link = &(*link)->next) {
+		if (!strcmp((*link)->name, name))
+			break;
+	}
+	return link;
+}
+
+/**
+ * join_entry() - get the path of @name in a CDPATH entry
+ *
+ * An empty entry is the current directory.
+ */
+static char *join_entry(const char *dir, size_t dir_len, const char *name)
+{
+	char *path;
+
+	if (!dir_len)
+		return strdup(name);
+	if (asprintf(&path, "%.*s/%s", (int)dir_len, dir, name) < 0)
+		return NULL;
+	return path;
+}
+
+/**
+ * get_dir_id() - identify the directory of a CDPATH entry
+ *
+ * An empty entry is the current directory, and a relative one is
+ * found from it, so changing directory changes their identity.  An
+ * entry which does not exist is all zeros.
+ *
+ * Return: false if the directory changed so recently that another
+ * change in the same clock tick would not change its mtime, so it
+ * must not be trusted.
+ */
+static bool get_dir_id(const char *dir, size_t dir_len, struct dir_id *id)
+{
+	char *path = dir_len ? strndup(dir, dir_len) : strdup(".");
+	struct stat st;
+	int err = stat(path, &st);
+
+	free(path);
+	memset(id, 0, sizeof(*id));
+	if (err)
+		return true;
+	id->dev = st.st_dev;
+	id->ino = st.st_ino;
+	id->mtime = st.st_mtim;
+	return st.st_mtim.tv_sec < time(NULL) - 1;
+}
+
+/**
+ * entries_unchanged() - check the CDPATH entries before a cached one
+ *
+ * Return: true if none of them can have gained the cached name.
+ */
+static bool entries_unchanged(const char *cdpath,
+			      const struct cdpath_entry *entry)
+{
+	const char *dir = cdpath;
+	struct dir_id id;
+	size_t dir_len;
+
+	for (size_t i = 0; i < entry->n_before; i++, dir += dir_len + 1) {
+		dir_len = strcspn(dir, ":");
+		get_dir_id(dir, dir_len, &id);
+		if (id.dev != entry->before[i].dev ||
+		    id.ino != entry->before[i].ino ||
+		    id.mtime.tv_sec != entry->before[i].mtime.tv_sec ||
+		    id.mtime.tv_nsec != entry->before[i].mtime.tv_nsec)
+			return false;
+	}
+	return true;
+}
+
+char *cdpath_lookup(const char *name, bool *from_cdpath)
+{
+	const char *cdpath = var_get("CDPATH");
+	struct cdpath_entry **link;
+	struct cdpath_entry *entry;
+	struct dir_id *before;
+	size_t n_before = 0;
+	bool cacheable = true;
+	const char *dir;
+	size_t dir_len;
+	char *path;
+
+	*from_cdpath = false;
+	if (!cdpath || !*cdpath || name[0] == '/' || !strcmp(name, ".") ||
+	    !strcmp(name, "..") || !strncmp(name, "./", 2) ||
+	    !strncmp(name, "../", 3))
+		return strdup(name);
+
+	if (!cached_cdpath_var || strcmp(cached_cdpath_var, cdpath)) {
+		clear_cache();
+		cached_cdpath_var = strdup(cdpath);
+	}
+
+	link = find_entry(name);
+	entry = *link;
+	if (entry) {
+		path = entries_unchanged(cdpath, entry) ?
+			       join_entry(entry->dir, strlen(entry->dir), name) :
+			       NULL;
+		if (path && is_directory(path)) {
+			STATS_INC(cdpath_cache_hits);
+			*from_cdpath = true;
+			return path;
+		}
+
+		/* It has gone, or may be in an earlier entry.  Search again. */
+		free(path);
+		*link = entry->next;
+		free(entry->name);
+		free(entry->dir);
+		free(entry->before);
+		free(entry);
+	}
+
+	STATS_INC(cdpath_cache_misses);
+	before = malloc((strlen(cdpath) + 1) * sizeof(*before));
+	for (dir = cdpath;; dir += dir_len + 1) {
+		dir_len = strcspn(dir, ":");
+		path = join_entry(dir, dir_len, name);
+		if (path && is_directory(path))
+			break;
+		free(path);
+		path = NULL;
+		if (!dir[dir_len])
+			break;
+		if (!get_dir_id(dir, dir_len, &before[n_before++]))
+			cacheable = false;
+	}
+
+	/* A match in the current directory depends on where that is. */
+	if (!path || dir[0] != '/' || !cacheable) {
+		free(before);
+		if (!path)
+			return strdup(name);
+		*from_cdpath = dir_len;
+		return path;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	entry->name = strdup(name);
+	entry->dir = strndup(dir, dir_len);
+	entry->before = before;
+	entry->n_before = n_before;
+	link = find_entry(name);
+	entry->next = *link;
+	*link = entry;
+	*from_cdpath = true;
+	return path;
+}
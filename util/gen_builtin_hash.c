@@ -0,0 +1,167 @@
+/*
+ * gen_builtin_hash - generate a perfect hash of the builtin names
+ *
+ * Usage: gen_builtin_hash src/shell_builtins.c OUTPUT.h
+ *
+ * The names are read from the builtin_commands[] initializer, which
+ * stays the single source of truth.  A seed is searched for which
+ * maps every name to a distinct slot of a power-of-two sized table,
+ * and the seed and table are written out as a header.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strhash.h"
+
+#define MAX_SEED_TRIES 1000000
+
+static char **names;
+static size_t n_names;
+
+static void add_name(const char *name, size_t len)
+{
+	names = realloc(names, (n_names + 1) * sizeof(*names));
+	names[n_names++] = strndup(name, len);
+}
+
+/**
+ * read_names() - collect the names in the builtin_commands[] array
+ *
+ * Each entry is expected to start with "{ \"name\"", one per line,
+ * up to the closing "};".
+ */
+static int read_names(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char *line = NULL;
+	size_t sz = 0;
+	bool in_array = false;
+	const char *p, *end;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (getline(&line, &sz, f) > 0) {
+		if (!in_array) {
+			in_array = strstr(line, "builtin_commands[] = {");
+			continue;
+		}
+		if (strstr(line, "};"))
+			break;
+
+		p = line + strspn(line, " \t");
+		if (strncmp(p, "{ \"", 3))
+			continue;
+		p += 3;
+		end = strchr(p, '"');
+		if (end)
+			add_name(p, end - p);
+	}
+
+	free(line);
+	fclose(f);
+
+	if (!n_names) {
+		fprintf(stderr, "%s: no builtin_commands[] entries found\n",
+			path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * try_seed() - fill @slots using @seed
+ *
+ * Return: true if every name got a distinct slot.
+ */
+static bool try_seed(uint32_t seed, int *slots, size_t size)
+{
+	size_t slot;
+
+	for (size_t i = 0; i < size; i++)
+		slots[i] = -1;
+	for (size_t i = 0; i < n_names; i++) {
+		slot = strhash(names[i], seed) & (size - 1);
+		if (slots[slot] >= 0)
+			return false;
+		slots[slot] = i;
+	}
+	return true;
+}
+
+static int write_header(const char *path, uint32_t seed, const int *slots,
+			size_t size)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(f, "/* Generated by util/gen_builtin_hash.  Do not edit. */\n");
+	fprintf(f, "#ifndef _BUILTIN_HASH_H\n#define _BUILTIN_HASH_H\n\n");
+	fprintf(f, "#define BUILTIN_HASH_COUNT %zu\n", n_names);
+	fprintf(f, "#define BUILTIN_HASH_SEED 0x%08xu\n", seed);
+	fprintf(f, "#define BUILTIN_HASH_SIZE %zu\n\n", size);
+	fprintf(f, "/* The builtin_commands[] index for each slot, or -1. */\n");
+	fprintf(f, "static const short builtin_hash_slots[BUILTIN_HASH_SIZE] = {\n");
+	for (size_t i = 0; i < size; i++) {
+		if (slots[i] >= 0)
+			fprintf(f, "\t[%zu] = %d, /* %s */\n", i, slots[i],
+				names[slots[i]]);
+		else
+			fprintf(f, "\t[%zu] = -1,\n", i);
+	}
+	fprintf(f, "};\n\n#endif /* _BUILTIN_HASH_H */\n");
+
+	if (fclose(f)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = 1;
+	int *slots;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s shell_builtins.c output.h\n",
+			argv[0]);
+		return 1;
+	}
+	if (read_names(argv[1]) < 0)
+		return 1;
+
+	for (size_t i = 0; i < n_names; i++) {
+		for (size_t j = 0; j < i; j++) {
+			if (!strcmp(names[i], names[j])) {
+				fprintf(stderr, "%s: duplicate builtin \"%s\"\n",
+					argv[1], names[i]);
+				return 1;
+			}
+		}
+	}
+
+	while (size < 2 * n_names)
+		size *= 2;
+
+	for (;; size *= 2) {
+		slots = malloc(size * sizeof(*slots));
+		for (uint32_t seed = 0; seed < MAX_SEED_TRIES; seed++) {
+			if (try_seed(seed, slots, size))
+				return write_header(argv[2], seed, slots,
+						    size) < 0;
+		}
+		free(slots);
+	}
+}